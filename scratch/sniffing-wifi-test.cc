@@ -1,4 +1,5 @@
 #include "ns3/vpn-application.h" 
+#include "ns3/vpn-payload.h"
 #include "ns3/core-module.h"
 #include "ns3/network-module.h"
 #include "ns3/internet-module.h"
@@ -47,15 +48,20 @@ Sniffer (Ptr<const Packet> p)
     NS_LOG_DEBUG("\n>> SNIFFING START");
     VpnHeader vpnHeader;
     copy->RemoveHeader(vpnHeader);
-    NS_LOG_DEBUG("Sniffing : decrypted data -> " << vpnHeader.DecryptInput("00000000000000000000000000000000", false));
+    NS_LOG_DEBUG("Sniffing : session " << vpnHeader.GetSessionId() << " sequence " << vpnHeader.GetSequence());
 
-    if (vpnHeader.DecryptInput("00000000000000000000000000000000", false) != vpnHeader.GetSentOrigin())
+    // only the inner packet carries addresses now, try it with a guessed key
+    Ptr<VpnCipher> guess = VpnCipher::Create("AES-128-ECB");
+    guess->SetKey("00000000000000000000000000000000");
+    bool ok = false;
+    VpnPayload::DecryptBatch(&copy, &vpnHeader, 1, guess, &ok);
+    Ipv4Header ipHeader;
+    if (!ok || copy->PeekHeader(ipHeader) == 0)
     {
         NS_LOG_DEBUG(">> SNIFFING FAIL");
         return;
     }
     
-    Ipv4Header ipHeader;
     copy->RemoveHeader(ipHeader);
     if (ipHeader.GetProtocol() == 6)
     {
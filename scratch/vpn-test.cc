@@ -52,7 +52,8 @@ int main(int argc, char *argv[])
 
     Packet init;
     init.EnablePrinting();
-    init.EnableChecking();
+    // no EnableChecking : the tunnel rewrites the inner packet as encrypted bytes, so the receiver's inner
+    // headers cannot be matched against the sender's header metadata
 
     PacketMetadata::Enable();
 
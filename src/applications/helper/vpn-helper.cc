@@ -67,9 +67,25 @@ namespace ns3
         m_factory.Set(name, value);
     }
 
+    void VPNHelper::SetCipher(std::string cipher, std::string cipherKey)
+    {
+        SetAttribute("Cipher", StringValue(cipher));
+        SetAttribute("CipherKey", StringValue(cipherKey));
+    }
+
+    // session ids handed out to applications left at SessionId 0, across all helpers
+    static uint32_t g_nextSessionId = 1;
+
     ApplicationContainer VPNHelper::Install(Ptr<Node> node) const
     {
         Ptr<Application> app = m_factory.Create<VPNApplication>();
+        // the payload nonce is session id || sequence, two peers under one key must not share a session
+        UintegerValue sessionId;
+        app->GetAttribute("SessionId", sessionId);
+        if (sessionId.Get() == 0)
+        {
+            app->SetAttribute("SessionId", UintegerValue(g_nextSessionId++));
+        }
         node->AddApplication(app);
         return app;
     }
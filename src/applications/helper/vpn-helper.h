@@ -23,7 +23,9 @@ namespace ns3
         VPNHelper(Ipv4Address serverIp);
 
         void SetAttribute(std::string name, const AttributeValue &value);
+        void SetCipher(std::string cipher, std::string cipherKey); // cipher suite name (see VpnCipher::GetNames) and its key
 
+        // an application without a SessionId gets one no other application installed by a VPNHelper has
         ApplicationContainer Install(Ptr<Node> node) const;
 
     private:
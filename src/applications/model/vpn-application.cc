@@ -4,7 +4,6 @@
 #include "ns3/ipv4-address.h"
 #include "ns3/ipv4-header.h"
 #include "ns3/ipv4-interface-address.h"
-#include "ns3/udp-header.h"
 #include "ns3/mac48-address.h"
 #include "ns3/inet-socket-address.h"
 #include "ns3/net-device.h"
@@ -13,11 +12,22 @@
 #include "ns3/socket-factory.h"
 #include "ns3/packet.h"
 #include "ns3/uinteger.h"
+#include "ns3/boolean.h"
+#include "ns3/nstime.h"
+#include "ns3/ipv4-route.h"
+#include "ns3/ipv4-routing-protocol.h"
 #include "ns3/application.h"
 #include "vpn-application.h"
 #include "ns3/vpn-aes.h" // for using aes cryption
 #include "ns3/vpn-header.h"
+#include "ns3/vpn-payload.h"
+#include "ns3/vpn-tunnel-mtu.h"
 #include "ns3/string.h"
+#include "ns3/abort.h"
+#include "ns3/simulator.h"
+#include <algorithm>
+#include <functional>
+#include <memory>
 
 namespace ns3
 {
@@ -58,11 +68,93 @@ namespace ns3
                                               "Private Cipher Key",
                                               StringValue("12345678901234567890123456789012"),
                                               MakeStringAccessor(&VPNApplication::m_cipherKey),
-                                              MakeStringChecker());
+                                              MakeStringChecker())
+                                .AddAttribute("Cipher",
+                                              "Cipher suite of the tunnel (AES-128-ECB ... AES-256-GCM, ChaCha20-Poly1305)",
+                                              StringValue("AES-128-ECB"),
+                                              MakeStringAccessor(&VPNApplication::m_cipherName),
+                                              MakeStringChecker())
+                                .AddAttribute("SessionId",
+                                              "Session of this client, unique per key : the server selects the key added by AddPeer with it",
+                                              UintegerValue(0),
+                                              MakeUintegerAccessor(&VPNApplication::m_sessionId),
+                                              MakeUintegerChecker<uint32_t>())
+                                .AddAttribute("ReplayWindow",
+                                              "Sequence numbers per session remembered against replay (multiple of 64)",
+                                              UintegerValue(VpnReplayWindow::DEFAULT_SIZE),
+                                              MakeUintegerAccessor(&VPNApplication::m_replayWindowSize),
+                                              MakeUintegerChecker<uint32_t>(64, 65536))
+                                .AddAttribute("HeaderCompression",
+                                              "Send only the changing fields of the inner IPv4 / UDP headers (authenticated suites only)",
+                                              BooleanValue(false),
+                                              MakeBooleanAccessor(&VPNApplication::m_headerCompression),
+                                              MakeBooleanChecker())
+                                .AddAttribute("PayloadCompression",
+                                              "LZ compress the packets we send, flows that do not compress are left alone",
+                                              BooleanValue(false),
+                                              MakeBooleanAccessor(&VPNApplication::m_payloadCompression),
+                                              MakeBooleanChecker())
+                                .AddAttribute("UnderlayMtu",
+                                              "MTU of the path to the server, at least 576. 0 : MTU of the device toward it",
+                                              UintegerValue(0),
+                                              MakeUintegerAccessor(&VPNApplication::m_underlayMtu),
+                                              MakeUintegerChecker<uint16_t>())
+                                .AddAttribute("MssClamping",
+                                              "Lower the MSS of TCP SYNs through the tunnel to fit its MTU",
+                                              BooleanValue(true),
+                                              MakeBooleanAccessor(&VPNApplication::m_mssClamping),
+                                              MakeBooleanChecker())
+                                .AddAttribute("MtuProbing",
+                                              "Search the path MTU to the server with probes sent with DF",
+                                              BooleanValue(false),
+                                              MakeBooleanAccessor(&VPNApplication::m_mtuProbing),
+                                              MakeBooleanChecker())
+                                .AddAttribute("MtuProbeTimeout",
+                                              "A probe not acknowledged within this time is taken as too big",
+                                              TimeValue(Seconds(1)),
+                                              MakeTimeAccessor(&VPNApplication::m_probeTimeout),
+                                              MakeTimeChecker())
+                                .AddAttribute("Aggregation",
+                                              "Pack several small inner packets into one tunnel datagram",
+                                              BooleanValue(false),
+                                              MakeBooleanAccessor(&VPNApplication::m_aggregation),
+                                              MakeBooleanChecker())
+                                .AddAttribute("AggregationDelay",
+                                              "Longest time a packet waits for others to share its datagram",
+                                              TimeValue(MicroSeconds(500)),
+                                              MakeTimeAccessor(&VPNApplication::m_aggregationDelay),
+                                              MakeTimeChecker())
+                                .AddAttribute("AggregationSize",
+                                              "Queued bytes that are sent without waiting, 0 : the tunnel MTU",
+                                              UintegerValue(0),
+                                              MakeUintegerAccessor(&VPNApplication::m_aggregationSize),
+                                              MakeUintegerChecker<uint32_t>())
+                                .AddAttribute("ReceiveBudget",
+                                              "Datagrams taken from the socket per receive callback, 0 : all of them",
+                                              UintegerValue(64),
+                                              MakeUintegerAccessor(&VPNApplication::m_receiveBudget),
+                                              MakeUintegerChecker<uint32_t>());
         return tid;
     }
 
     VPNApplication::VPNApplication()
+        : m_sequence(0),
+          m_replayWindowSize(VpnReplayWindow::DEFAULT_SIZE),
+          m_headerCompression(false),
+          m_payloadCompression(false),
+          m_underlayMtu(0),
+          m_mssClamping(true),
+          m_mtuProbing(false),
+          m_tunnelMtu(0),
+          m_pathMtu(0),
+          m_probeLow(0),
+          m_probeHigh(0),
+          m_probeSize(0),
+          m_aggregation(false),
+          m_aggregationSize(0),
+          m_sendQueueBytes(0),
+          m_batchOkSize(0),
+          m_receiveBudget(64)
     {
         NS_LOG_FUNCTION(this);
     }
@@ -89,66 +181,417 @@ namespace ns3
     void VPNApplication::SetCipherKey(std::string cipherKey)
     {
         NS_LOG_FUNCTION(this << cipherKey);
-        m_cipherKey = cipherKey;
+        m_cipherKey = cipherKey; // keyed into the cipher suite when the application starts
+    }
+
+    bool VPNApplication::AddPeer(uint32_t sessionId, Ipv4Address tunnelAddress, std::string cipherKey)
+    {
+        NS_LOG_FUNCTION(this << sessionId << tunnelAddress);
+        return m_peers.Add(sessionId, tunnelAddress, m_cipherName, cipherKey);
+    }
+
+    Ptr<VpnCipher> VPNApplication::GetPeerCipher(uint32_t sessionId) const
+    {
+        Ptr<VpnCipher> cipher = m_peers.Lookup(sessionId);
+        return cipher ? cipher : m_cipher;
+    }
+
+    // true if sequence was not seen yet in the session, record : remember it from now on
+    bool VPNApplication::AcceptSequence(uint32_t sessionId, uint64_t sequence, bool record)
+    {
+        std::unordered_map<uint32_t, VpnReplayWindow>::iterator it = m_replay.find(sessionId);
+        if (!record)
+        {
+            return it == m_replay.end() || it->second.Check(sequence);
+        }
+        if (it == m_replay.end())
+        {
+            it = m_replay.insert(std::make_pair(sessionId, VpnReplayWindow(m_replayWindowSize))).first;
+        }
+        return it->second.Update(sequence);
+    }
+
+    // create the selected cipher suite and key it with m_cipherKey
+    void VPNApplication::SetupCipher(void)
+    {
+        m_cipher = VpnCipher::Create(m_cipherName);
+        NS_ABORT_MSG_UNLESS(m_cipher, "Unknown cipher suite " << m_cipherName);
+        NS_ABORT_MSG_UNLESS(m_cipher->SetKey(m_cipherKey),
+                            m_cipherName << " needs a " << m_cipher->GetKeySize() * 8 << " bits CipherKey");
     }
+
+    // packets sent by the TAP device at the same simulation time (or within AggregationDelay when aggregating)
+    // are queued and encrypted in one batch
     bool VPNApplication::SendPacket(Ptr<Packet> packet, const Address &src, const Address &dst, uint16_t protocolNumber)
     {
         NS_LOG_DEBUG("\nSend packet from VPN client " << m_clientVPNAddress << " -> " << m_serverAddress);
-        ///// encrypt *packet
         NS_LOG_DEBUG("Send to : " << m_serverAddress << ": " << *packet << "with size " << packet->GetSize());
 
-        VpnHeader crypthdr;
-        std::string plainText = "62531124552322311567ABD150BBFFCC";
-
-        crypthdr.EncryptInput(plainText, m_cipherKey, false);
-        packet->AddHeader(crypthdr);
-        NS_LOG_DEBUG("Send to : encrypted -> " << crypthdr.GetEncrypted());
-        NS_LOG_DEBUG("Send to : originwas -> " << crypthdr.GetSentOrigin());
+        if (m_mssClamping)
+        {
+            VpnTunnelMtu::ClampMss(packet, m_tunnelMtu - 40);
+        }
+        m_sendQueue.push_back(packet);
+        m_sendQueueBytes += packet->GetSize();
 
-        // send encrypted packet to VPN server
-        m_clientSocket->SendTo(packet, 0, InetSocketAddress(m_serverAddress, m_serverPort));
+        // aggregation holds small packets back for AggregationDelay, unless enough arrived to fill datagrams
+        uint32_t budget = m_aggregationSize ? m_aggregationSize : m_tunnelMtu;
+        if (m_aggregation && m_sendQueueBytes < budget)
+        {
+            if (!m_flushEvent.IsRunning())
+            {
+                m_flushEvent = Simulator::Schedule(m_aggregationDelay, &VPNApplication::FlushSendQueue, this);
+            }
+        }
+        else if (!m_flushEvent.IsRunning() || Simulator::GetDelayLeft(m_flushEvent) > Seconds(0))
+        {
+            Simulator::Cancel(m_flushEvent);
+            m_flushEvent = Simulator::ScheduleNow(&VPNApplication::FlushSendQueue, this);
+        }
         return true;
     }
 
+    void VPNApplication::FlushSendQueue(void)
+    {
+        NS_LOG_FUNCTION(this << m_sendQueue.size());
+        // block modes pad, the receiver then needs the inner length spelled out
+        bool explicitLength = m_cipher->GetOverhead(1) > m_cipher->GetTagSize();
+        // header compression keeps a context per session at the receiver, which only authenticated suites get
+        bool compressHeaders = m_headerCompression && m_cipher->GetTagSize() > 0;
+        m_sendFlags.assign(m_sendQueue.size(), 0);
+        for (size_t i = 0; i < m_sendQueue.size(); ++i)
+        {
+            uint64_t flow = m_payloadCompression ? VpnPayloadCompressor::GetFlow(m_sendQueue[i]) : 0;
+            if (compressHeaders)
+            {
+                m_sendFlags[i] = m_compressor.Compress(m_sendQueue[i], explicitLength);
+            }
+            if (m_payloadCompression && m_payloadCompressor.Compress(m_sendQueue[i], flow))
+            {
+                m_sendFlags[i] |= VpnHeader::FLAG_PAYLOAD_COMPRESSED;
+            }
+        }
+        if (m_aggregation)
+        {
+            Aggregate();
+        }
+
+        ///// encrypt *packet under session id || sequence, never reused within a session
+        m_sendHeaders.resize(m_sendQueue.size());
+        for (size_t i = 0; i < m_sendQueue.size(); ++i)
+        {
+            m_sendHeaders[i] = VpnHeader();
+            m_sendHeaders[i].SetSession(m_sessionId, ++m_sequence);
+            m_sendHeaders[i].SetFlags(m_sendFlags[i]);
+        }
+        VpnPayload::EncryptBatch(m_sendQueue.data(), m_sendHeaders.data(), m_sendQueue.size(), m_cipher);
+
+        for (size_t i = 0; i < m_sendQueue.size(); ++i)
+        {
+            Ptr<Packet> packet = m_sendQueue[i];
+            packet->AddHeader(m_sendHeaders[i]);
+            NS_LOG_DEBUG("Send to : session " << m_sendHeaders[i].GetSessionId() << " sequence " << m_sendHeaders[i].GetSequence());
+
+            // send encrypted packet to VPN server
+            m_clientSocket->SendTo(packet, 0, InetSocketAddress(m_serverAddress, m_serverPort));
+        }
+        m_sendQueue.clear();
+        m_sendQueueBytes = 0;
+    }
+
+    // packs runs of queued packets into datagrams of at most the tunnel MTU, each inner packet framed as
+    // flags(8) length(16) bytes. a packet that shares its datagram with no other goes out as it is
+    void VPNApplication::Aggregate(void)
+    {
+        // GetTunnelMtu keeps one byte for the context id of header compression, a datagram may use it
+        uint32_t budget = m_tunnelMtu + 1;
+        m_datagrams.clear();
+        m_datagramFlags.clear();
+        size_t i = 0;
+        while (i < m_sendQueue.size())
+        {
+            uint32_t length = 0;
+            size_t j = i;
+            while (j < m_sendQueue.size() && length + 3 + m_sendQueue[j]->GetSize() <= budget)
+            {
+                length += 3 + m_sendQueue[j]->GetSize();
+                ++j;
+            }
+            if (j - i <= 1)
+            {
+                m_datagrams.push_back(m_sendQueue[i]);
+                m_datagramFlags.push_back(m_sendFlags[i]);
+                ++i;
+                continue;
+            }
+
+            if (m_aggregate.size() < length)
+            {
+                m_aggregate.resize(length);
+            }
+            uint8_t *frame = m_aggregate.data();
+            for (; i < j; ++i)
+            {
+                uint32_t size = m_sendQueue[i]->GetSize();
+                frame[0] = m_sendFlags[i];
+                frame[1] = size >> 8;
+                frame[2] = size & 0xff;
+                m_sendQueue[i]->CopyData(frame + 3, size);
+                frame += 3 + size;
+            }
+            m_datagrams.push_back(Create<Packet>(m_aggregate.data(), length));
+            m_datagramFlags.push_back(VpnHeader::FLAG_AGGREGATE);
+        }
+        NS_LOG_DEBUG("Aggregated " << m_sendQueue.size() << " packets into " << m_datagrams.size());
+        // the queue and the datagrams trade places, both keep their capacity for the next flush
+        m_sendQueue.swap(m_datagrams);
+        m_sendFlags.swap(m_datagramFlags);
+        m_datagrams.clear();
+    }
+
+    // everything waiting in the socket, up to ReceiveBudget datagrams, is decrypted in one batch per peer key.
+    // the rest gets its own turn right after, so one burst does not hold up other events. the per call state
+    // lives in members that keep their capacity, so once warmed up the path allocates nothing but the packets
     void VPNApplication::ReceivePacket(Ptr<Socket> socket)
     {
-        Ptr<Packet> packet = socket->Recv(65535, 0);
-        NS_LOG_DEBUG("\nVPN server received");
-        ///// decrypt *packet
-        VpnHeader crypthdr;
-        packet->RemoveHeader(crypthdr);
-        NS_LOG_DEBUG("Received " << *packet << "with decrypt message");
-        NS_LOG_DEBUG("Received : received encrypted -> " << crypthdr.GetEncrypted());
-        NS_LOG_DEBUG("Received : received originwas -> " << crypthdr.GetSentOrigin());
-        NS_LOG_DEBUG("Received : received decrypted -> " << crypthdr.DecryptInput(m_cipherKey, false));
-
-        // forward decrypted packet
-        Ptr<Packet> copy = packet->Copy();
+        m_received.clear();
+        Ptr<Packet> packet;
+        Address from;
+        uint32_t read = 0;
+        while ((!m_receiveBudget || read < m_receiveBudget) && (packet = socket->RecvFrom(65535, 0, from)))
+        {
+            ++read;
+            NS_LOG_DEBUG("\nVPN server received");
+            // the key is picked from the session id before the header is taken off
+            uint32_t sessionId;
+            uint64_t sequence;
+            uint8_t flags;
+            uint8_t tagLength;
+            if (!VpnHeader::Peek(packet, sessionId, sequence, flags, tagLength))
+            {
+                NS_LOG_DEBUG("Dropping packet without VPN header");
+                continue;
+            }
+            // our own session only comes back to us reversed, the sessions of others only forward. a packet
+            // reflected to its sender would otherwise pass authentication and move the window of the session
+            if (((flags & VpnHeader::FLAG_REVERSE) != 0) != (sessionId == m_sessionId))
+            {
+                NS_LOG_DEBUG("Dropping packet of session " << sessionId << " sent in the wrong direction");
+                continue;
+            }
+            Ptr<VpnCipher> cipher = GetPeerCipher(sessionId);
+            if (tagLength != cipher->GetTagSize())
+            {
+                NS_LOG_DEBUG("Dropping packet of session " << sessionId << " with a tag of " << (uint32_t)tagLength << " bytes");
+                continue;
+            }
+            // a session belongs to the address it first came from, a second client in it is not let in
+            std::unordered_map<uint32_t, Address>::const_iterator owner = m_sessionOwners.find(sessionId);
+            if (owner != m_sessionOwners.end() && owner->second != from)
+            {
+                NS_LOG_DEBUG("Dropping packet of session " << sessionId << " taken by another peer");
+                continue;
+            }
+            // replays and stale packets go before any decryption work. without a tag anyone can write any
+            // sequence, so only authenticated suites keep a window
+            if (cipher->GetTagSize() > 0 && !AcceptSequence(sessionId, sequence, false))
+            {
+                NS_LOG_DEBUG("Dropping replayed packet of session " << sessionId << " sequence " << sequence);
+                continue;
+            }
+            m_received.push_back(Received());
+            Received &received = m_received.back();
+            packet->RemoveHeader(received.crypthdr);
+            received.packet = packet;
+            received.cipher = cipher;
+            received.from = from;
+        }
+
+        ///// decrypt *packet, one batch per peer key : the batch lists the packets key by key, in arrival order
+        ///// within a key
+        size_t count = m_received.size();
+        m_batchOrder.resize(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            m_batchOrder[i] = i;
+        }
+        // sorted by key, the index keeps arrival order within one : std::sort works in place, stable_sort
+        // would take a buffer
+        std::sort(m_batchOrder.begin(), m_batchOrder.end(), [this](size_t a, size_t b) {
+            const VpnCipher *ca = PeekPointer(m_received[a].cipher);
+            const VpnCipher *cb = PeekPointer(m_received[b].cipher);
+            return std::less<const VpnCipher *>()(ca, cb) || (ca == cb && a < b);
+        });
+        m_batchPackets.clear();
+        m_batchHeaders.clear();
+        for (size_t k = 0; k < count; ++k)
+        {
+            m_batchPackets.push_back(m_received[m_batchOrder[k]].packet);
+            m_batchHeaders.push_back(m_received[m_batchOrder[k]].crypthdr);
+        }
+        if (m_batchOkSize < count)
+        {
+            m_batchOk.reset(new bool[count]);
+            m_batchOkSize = count;
+        }
+        for (size_t k = 0; k < count;)
+        {
+            Ptr<VpnCipher> cipher = m_received[m_batchOrder[k]].cipher;
+            size_t end = k;
+            while (end < count && m_received[m_batchOrder[end]].cipher == cipher)
+            {
+                ++end;
+            }
+            VpnPayload::DecryptBatch(m_batchPackets.data() + k, m_batchHeaders.data() + k, end - k, cipher, m_batchOk.get() + k);
+            k = end;
+        }
+
+        for (size_t k = 0; k < count; ++k)
+        {
+            const VpnHeader &crypthdr = m_batchHeaders[k];
+            Ptr<Packet> packet = m_batchPackets[k];
+            if (!m_batchOk[k])
+            {
+                NS_LOG_DEBUG("Dropping packet of session " << crypthdr.GetSessionId() << " : payload authentication failed");
+                continue;
+            }
+            const Received &received = m_received[m_batchOrder[k]];
+            // the first authentic packet takes the session, another peer may have tried it in the same batch.
+            // without a tag every packet passes, so those suites bind nothing that a stranger could take first
+            bool authenticated = received.cipher->GetTagSize() > 0;
+            if (authenticated && m_sessionOwners.insert(std::make_pair(crypthdr.GetSessionId(), received.from)).first->second != received.from)
+            {
+                NS_LOG_DEBUG("Dropping packet of session " << crypthdr.GetSessionId() << " taken by another peer");
+                continue;
+            }
+            // only authentic packets move the window, a duplicate may also sit in the same batch
+            if (authenticated && !AcceptSequence(crypthdr.GetSessionId(), crypthdr.GetSequence(), true))
+            {
+                NS_LOG_DEBUG("Dropping replayed packet of session " << crypthdr.GetSessionId() << " sequence " << crypthdr.GetSequence());
+                continue;
+            }
+            if (crypthdr.GetFlags() & VpnHeader::FLAG_PROBE)
+            {
+                SendProbeAck(socket, received.from, received.cipher, packet, crypthdr.GetSessionId());
+                continue;
+            }
+            if (crypthdr.GetFlags() & VpnHeader::FLAG_PROBE_ACK)
+            {
+                HandleProbeAck(packet);
+                continue;
+            }
+            if (crypthdr.GetFlags() & VpnHeader::FLAG_AGGREGATE)
+            {
+                Disaggregate(socket, packet, crypthdr);
+                continue;
+            }
+            HandleInner(socket, packet, crypthdr.GetFlags(), crypthdr);
+        }
+        // drop the references until the next call
+        m_received.clear();
+        m_batchPackets.clear();
+
+        if (m_receiveBudget && read == m_receiveBudget && socket->GetRxAvailable() && !m_receiveEvent.IsRunning())
+        {
+            m_receiveEvent = Simulator::ScheduleNow(&VPNApplication::ReceivePacket, this, socket);
+        }
+    }
+
+    // splits a datagram packed by Aggregate, the padding of block modes ends it like a zero length frame
+    void VPNApplication::Disaggregate(Ptr<Socket> socket, Ptr<Packet> datagram, const VpnHeader &crypthdr)
+    {
+        uint32_t length = datagram->GetSize();
+        if (m_aggregate.size() < length)
+        {
+            m_aggregate.resize(length);
+        }
+        datagram->CopyData(m_aggregate.data(), length);
+        uint32_t offset = 0;
+        while (offset + 3 <= length)
+        {
+            const uint8_t *frame = m_aggregate.data() + offset;
+            uint32_t size = (frame[1] << 8) | frame[2];
+            if (size == 0 || offset + 3 + size > length)
+            {
+                break;
+            }
+            HandleInner(socket, Create<Packet>(frame + 3, size), frame[0], crypthdr);
+            offset += 3 + size;
+        }
+    }
+
+    // one inner packet, decompressed per its flags and delivered
+    void VPNApplication::HandleInner(Ptr<Socket> socket, Ptr<Packet> packet, uint8_t flags, const VpnHeader &crypthdr)
+    {
+        // any peer may compress, receiving needs no setting
+        if ((flags & VpnHeader::FLAG_PAYLOAD_COMPRESSED) && !m_payloadCompressor.Decompress(packet))
+        {
+            NS_LOG_DEBUG("Dropping packet of session " << crypthdr.GetSessionId() << " : malformed compressed payload");
+            return;
+        }
+        // contexts are per session, ReceivePacket lets only the peer owning the session in. only authenticated
+        // suites have owners, the others could fill the table with forged sessions and share contexts
+        if ((flags & (VpnHeader::FLAG_HEADER_IR | VpnHeader::FLAG_HEADER_COMPRESSED)) && !GetPeerCipher(crypthdr.GetSessionId())->GetTagSize())
+        {
+            NS_LOG_DEBUG("Dropping packet of session " << crypthdr.GetSessionId() << " : compressed headers need an authenticated suite");
+            return;
+        }
+        if (!m_decompressors[crypthdr.GetSessionId()].Decompress(packet, flags))
+        {
+            NS_LOG_DEBUG("Dropping packet of session " << crypthdr.GetSessionId() << " : no header compression context");
+            return;
+        }
+        HandleReceived(socket, packet, crypthdr);
+    }
+
+    void VPNApplication::HandleReceived(Ptr<Socket> socket, Ptr<Packet> packet, const VpnHeader &crypthdr)
+    {
+        NS_LOG_DEBUG("Received " << *packet << "of session " << crypthdr.GetSessionId() << " sequence " << crypthdr.GetSequence());
+
+        // inner headers are read where they are : the ipv4 header by PeekHeader, the ports from the bytes behind it
         Ipv4Header ipHeader;
-        UdpHeader udpHeader;
-        copy->RemoveHeader(ipHeader);
-        copy->RemoveHeader(udpHeader);
+        if (!packet->PeekHeader(ipHeader))
+        {
+            NS_LOG_DEBUG("Dropping inner packet that is not IPv4");
+            return;
+        }
+        // block modes pad the payload, the inner IPv4 header knows the real length
+        uint32_t innerSize = ipHeader.GetSerializedSize() + ipHeader.GetPayloadSize();
+        if (packet->GetSize() > innerSize)
+        {
+            packet->RemoveAtEnd(packet->GetSize() - innerSize);
+        }
         Ipv4Address destinationIPAddress = ipHeader.GetDestination();
-        uint16_t destinationPort = udpHeader.GetDestinationPort();
 
         NS_LOG_DEBUG("\nVPN server received");
         NS_LOG_DEBUG("VPN client address: " << m_clientVPNAddress);
         NS_LOG_DEBUG("Source IP: " << ipHeader.GetSource());
         NS_LOG_DEBUG("Destination IP: " << destinationIPAddress);
-        NS_LOG_DEBUG("Source Port: " << udpHeader.GetSourcePort());
-        NS_LOG_DEBUG("Destination Port: " << destinationPort);
-        NS_LOG_DEBUG("Size: " << copy->GetSize());
+        NS_LOG_DEBUG("Size: " << innerSize);
 
-        if (m_clientVPNAddress == destinationIPAddress && !crypthdr.GetSentOrigin().compare(crypthdr.DecryptInput(m_cipherKey, false)))
+        if (m_clientVPNAddress == destinationIPAddress)
         {
             // Destiation of the packet is this VPN Client. Receive packet
+            if (m_mssClamping)
+            {
+                VpnTunnelMtu::ClampMss(packet, m_tunnelMtu - 40);
+            }
             m_clientTap->Receive(packet, 0x0800, m_clientTap->GetAddress(), m_clientTap->GetAddress(), NetDevice::PACKET_HOST);
         }
         else
         {
-            // Not for this VPN Client. Forwarding to destination
-            packet->RemoveHeader(ipHeader);
-            packet->RemoveHeader(udpHeader);
+            // Not for this VPN Client. Forwarding the UDP payload to destination
+            uint32_t ipSize = ipHeader.GetSerializedSize();
+            uint8_t headers[60 + 8];
+            if (ipHeader.GetProtocol() != 17 || packet->CopyData(headers, ipSize + 8) < ipSize + 8)
+            {
+                NS_LOG_DEBUG("Dropping inner packet that is not UDP, only UDP is forwarded");
+                return;
+            }
+            uint16_t destinationPort = (headers[ipSize + 2] << 8) | headers[ipSize + 3];
+            NS_LOG_DEBUG("Source Port: " << ((headers[ipSize] << 8) | headers[ipSize + 1]));
+            NS_LOG_DEBUG("Destination Port: " << destinationPort);
+            packet->RemoveAtStart(ipSize + 8);
             NS_LOG_DEBUG("\nNot for this VPN Client. Forwarding...\n");
             socket->SendTo(packet, 0, InetSocketAddress(destinationIPAddress, destinationPort));
         }
@@ -157,12 +600,26 @@ namespace ns3
     void VPNApplication::DoDispose()
     {
         NS_LOG_FUNCTION(this);
+        Simulator::Cancel(m_flushEvent);
+        Simulator::Cancel(m_probeEvent);
+        Simulator::Cancel(m_receiveEvent);
+        m_sendQueue.clear();
+        m_sendQueueBytes = 0;
+        m_datagrams.clear();
+        m_received.clear();
+        m_batchPackets.clear();
+        m_cipher = 0;
+        m_peers.Clear();
+        m_replay.clear();
+        m_sessionOwners.clear();
+        m_decompressors.clear();
         Application::DoDispose();
     }
 
     void VPNApplication::StartApplication(void)
     {
         // key exchange
+        SetupCipher();
 
         // get client IP
         // m_clientVPNAddress = ;
@@ -171,6 +628,12 @@ namespace ns3
         m_clientNode = GetNode();
         m_clientTap = CreateObject<VirtualNetDevice>();
         m_clientTap->SetAddress(Mac48Address::Allocate());
+        uint32_t pathMtu = m_underlayMtu ? m_underlayMtu : GetDeviceMtu();
+        NS_ABORT_MSG_IF(pathMtu < VpnTunnelMtu::MIN_UNDERLAY_MTU,
+                        "Underlay MTU " << pathMtu << " is below " << VpnTunnelMtu::MIN_UNDERLAY_MTU);
+        // with probing, data goes out with DF : it starts at the size every path carries and grows with the probes
+        bool probing = m_mtuProbing && m_serverAddress != Ipv4Address::GetAny() && pathMtu > VpnTunnelMtu::MIN_UNDERLAY_MTU;
+        SetPathMtu(probing ? VpnTunnelMtu::MIN_UNDERLAY_MTU : pathMtu);
         m_clientNode->AddDevice(m_clientTap);
 
         // create and bind socket
@@ -186,11 +649,130 @@ namespace ns3
         m_clientInterface = ipv4->AddInterface(m_clientTap);
         ipv4->AddAddress(m_clientInterface, Ipv4InterfaceAddress(m_clientVPNAddress, m_serverMask));
         ipv4->SetUp(m_clientInterface);
+
+        // DF on everything we send, the probes find what the path carries
+        if (probing)
+        {
+            m_clientSocket->SetAttribute("MtuDiscover", BooleanValue(true));
+            m_probeLow = VpnTunnelMtu::MIN_UNDERLAY_MTU;
+            m_probeHigh = pathMtu;
+            m_probeSize = pathMtu;
+            SendProbe();
+        }
+    }
+
+    // MTU of the device the route to the server leaves by. a server, with no server address, takes the
+    // largest of its devices
+    uint32_t VPNApplication::GetDeviceMtu(void) const
+    {
+        Ptr<Ipv4> ipv4 = m_clientNode->GetObject<Ipv4>();
+        if (m_serverAddress != Ipv4Address::GetAny() && ipv4->GetRoutingProtocol())
+        {
+            Ipv4Header header;
+            header.SetDestination(m_serverAddress);
+            Socket::SocketErrno error;
+            Ptr<Ipv4Route> route = ipv4->GetRoutingProtocol()->RouteOutput(0, header, 0, error);
+            if (route && route->GetOutputDevice())
+            {
+                return route->GetOutputDevice()->GetMtu();
+            }
+        }
+        uint32_t mtu = 0;
+        for (uint32_t i = 0; i < ipv4->GetNInterfaces(); ++i)
+        {
+            if (ipv4->GetNAddresses(i) && ipv4->GetAddress(i, 0).GetLocal() != Ipv4Address::GetLoopback())
+            {
+                mtu = std::max<uint32_t>(mtu, ipv4->GetMtu(i));
+            }
+        }
+        return mtu ? mtu : 1500;
+    }
+
+    // the TAP device gets what is left of pathMtu once the tunnel headers are added
+    void VPNApplication::SetPathMtu(uint32_t pathMtu)
+    {
+        m_pathMtu = pathMtu;
+        m_tunnelMtu = VpnTunnelMtu::GetTunnelMtu(pathMtu, m_cipher);
+        m_clientTap->SetMtu(m_tunnelMtu);
+        NS_LOG_DEBUG("Path MTU " << pathMtu << ", tunnel MTU " << m_tunnelMtu);
+    }
+
+    // probe of m_probeSize bytes on the wire : its payload is the probed size followed by zeros
+    void VPNApplication::SendProbe(void)
+    {
+        std::vector<uint8_t> bytes(VpnTunnelMtu::GetTunnelMtu(m_probeSize, m_cipher) + 1, 0);
+        bytes[0] = m_probeSize >> 8;
+        bytes[1] = m_probeSize & 0xff;
+        Ptr<Packet> probe = Create<Packet>(bytes.data(), bytes.size());
+
+        VpnHeader crypthdr;
+        crypthdr.SetSession(m_sessionId, ++m_sequence);
+        crypthdr.SetFlags(VpnHeader::FLAG_PROBE);
+        VpnPayload::EncryptBatch(&probe, &crypthdr, 1, m_cipher);
+        probe->AddHeader(crypthdr);
+        NS_LOG_DEBUG("MTU probe of " << m_probeSize << " bytes");
+        m_clientSocket->SendTo(probe, 0, InetSocketAddress(m_serverAddress, m_serverPort));
+        m_probeEvent = Simulator::Schedule(m_probeTimeout, &VPNApplication::ProbeTimeout, this);
+    }
+
+    // the ack goes back under the session of the prober, in the reverse direction so it takes no nonce of theirs
+    void VPNApplication::SendProbeAck(Ptr<Socket> socket, const Address &from, Ptr<VpnCipher> cipher, Ptr<Packet> probe, uint32_t sessionId)
+    {
+        uint8_t size[2];
+        if (probe->CopyData(size, 2) < 2)
+        {
+            return;
+        }
+        Ptr<Packet> ack = Create<Packet>(size, 2);
+        VpnHeader crypthdr;
+        crypthdr.SetSession(sessionId, ++m_sequence);
+        crypthdr.SetFlags(VpnHeader::FLAG_PROBE_ACK | VpnHeader::FLAG_REVERSE);
+        VpnPayload::EncryptBatch(&ack, &crypthdr, 1, cipher);
+        ack->AddHeader(crypthdr);
+        socket->SendTo(ack, 0, from);
+    }
+
+    // binary search between the largest size acknowledged and the smallest one lost. the path MTU only
+    // follows the acknowledged sizes up
+    void VPNApplication::HandleProbeAck(Ptr<Packet> ack)
+    {
+        uint8_t size[2];
+        if (!m_probeEvent.IsRunning() || ack->CopyData(size, 2) < 2 || uint32_t((size[0] << 8) | size[1]) != m_probeSize)
+        {
+            return;
+        }
+        Simulator::Cancel(m_probeEvent);
+        m_probeLow = m_probeSize;
+        SetPathMtu(m_probeLow);
+        NextProbe();
+    }
+
+    void VPNApplication::ProbeTimeout(void)
+    {
+        NS_LOG_DEBUG("MTU probe of " << m_probeSize << " bytes lost");
+        m_probeHigh = m_probeSize - 1;
+        NextProbe();
+    }
+
+    void VPNApplication::NextProbe(void)
+    {
+        if (m_probeHigh - m_probeLow < 16)
+        {
+            NS_LOG_DEBUG("Path MTU " << m_pathMtu << " after probing");
+            return;
+        }
+        m_probeSize = (m_probeLow + m_probeHigh + 1) / 2;
+        SendProbe();
     }
 
     void VPNApplication::StopApplication(void)
     {
         // send client exit to server
+        if (m_flushEvent.IsRunning())
+        {
+            Simulator::Cancel(m_flushEvent);
+            FlushSendQueue();
+        }
 
         // remove interface
         Ptr<Ipv4> ipv4 = m_clientNode->GetObject<Ipv4>();
@@ -201,6 +783,7 @@ namespace ns3
         // m_clientTap->SendSendCallback (MakeNullCallback ());
 
         // unbind socket
+        Simulator::Cancel(m_receiveEvent);
         m_clientSocket->ShutdownRecv();
         m_clientSocket->Close();
     }
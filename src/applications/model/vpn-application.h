@@ -11,6 +11,18 @@
 #include "ns3/application.h"
 #include "ns3/ipv4-address.h"
 #include "ns3/virtual-net-device.h"
+#include "ns3/vpn-aes.h"
+#include "ns3/vpn-cipher.h"
+#include "ns3/vpn-header.h"
+#include "ns3/vpn-header-compressor.h"
+#include "ns3/vpn-key-table.h"
+#include "ns3/vpn-payload-compressor.h"
+#include "ns3/vpn-replay-window.h"
+#include "ns3/event-id.h"
+#include "ns3/nstime.h"
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
 namespace ns3
 {
@@ -31,6 +43,8 @@ namespace ns3
         void SetServer(Ipv4Address addr, uint16_t port);
         void SetServer(Ipv4Address addr);
         void SetCipherKey(std::string cipherKey);
+        // server side : own key for one client, in the suite of the Cipher attribute. false if the key does not fit
+        bool AddPeer(uint32_t sessionId, Ipv4Address tunnelAddress, std::string cipherKey);
 
         bool SendPacket(Ptr<Packet> packet, const Address &src, const Address &dst, uint16_t ptorocolNumber);
         void ReceivePacket(Ptr<Socket> socket);
@@ -41,6 +55,21 @@ namespace ns3
     private:
         virtual void StartApplication(void);
         virtual void StopApplication(void);
+        void SetupCipher(void);
+        void FlushSendQueue(void);
+        void Aggregate(void);
+        void Disaggregate(Ptr<Socket> socket, Ptr<Packet> datagram, const VpnHeader &crypthdr);
+        void HandleInner(Ptr<Socket> socket, Ptr<Packet> packet, uint8_t flags, const VpnHeader &crypthdr);
+        Ptr<VpnCipher> GetPeerCipher(uint32_t sessionId) const;
+        bool AcceptSequence(uint32_t sessionId, uint64_t sequence, bool record);
+        void HandleReceived(Ptr<Socket> socket, Ptr<Packet> packet, const VpnHeader &crypthdr);
+        uint32_t GetDeviceMtu(void) const;
+        void SetPathMtu(uint32_t pathMtu);
+        void SendProbe(void);
+        void SendProbeAck(Ptr<Socket> socket, const Address &from, Ptr<VpnCipher> cipher, Ptr<Packet> probe, uint32_t sessionId);
+        void HandleProbeAck(Ptr<Packet> ack);
+        void ProbeTimeout(void);
+        void NextProbe(void);
 
         Ipv4Address m_serverAddress; // IP address of server
         uint16_t m_serverPort;       // port for server
@@ -54,6 +83,60 @@ namespace ns3
         Ptr<VirtualNetDevice> m_clientTap; // client TAP device
         
         std::string m_cipherKey; // key
+        std::string m_cipherName; // cipher suite name, see VpnCipher::GetNames
+        Ptr<VpnCipher> m_cipher;  // cipher suite keyed with m_cipherKey
+        VpnKeyTable m_peers;      // per client keys of a server, peers not in it use m_cipher
+        uint32_t m_sessionId;     // session of this client, selects its key on the server
+        uint64_t m_sequence;      // packets sent in this session, part of the payload nonce
+        uint32_t m_replayWindowSize;                                       // width of the anti-replay windows
+        std::unordered_map<uint32_t, VpnReplayWindow> m_replay;            // received sequence numbers per session
+        std::unordered_map<uint32_t, Address> m_sessionOwners;             // peer of every session, from its first packet
+        bool m_headerCompression;                                          // compress the inner headers we send
+        VpnHeaderCompressor m_compressor;                                  // flows we send
+        std::unordered_map<uint32_t, VpnHeaderCompressor> m_decompressors; // flows received, per session and so per peer
+        bool m_payloadCompression;                                         // LZ compress the packets we send
+        VpnPayloadCompressor m_payloadCompressor;                          // both directions, sampling per flow we send
+
+        uint16_t m_underlayMtu; // UnderlayMtu attribute, 0 : from the device
+        bool m_mssClamping;     // clamp TCP SYNs to m_tunnelMtu
+        bool m_mtuProbing;      // search the path MTU to the server
+        Time m_probeTimeout;    // wait for a probe ack
+        uint32_t m_tunnelMtu;   // MTU of the TAP device
+        uint32_t m_pathMtu;     // outer packets up to this size get through unfragmented
+        uint32_t m_probeLow;    // largest size known to get through
+        uint32_t m_probeHigh;   // largest size not known to be lost
+        uint32_t m_probeSize;   // size of the probe in flight
+        EventId m_probeEvent;   // timeout of the probe in flight
+
+        bool m_aggregation;               // pack small packets into shared datagrams
+        Time m_aggregationDelay;          // longest wait for company
+        uint32_t m_aggregationSize;       // queued bytes that flush at once, 0 : m_tunnelMtu
+        std::vector<uint8_t> m_aggregate; // scratch for packing and splitting datagrams
+
+        // one packet taken from the socket by ReceivePacket
+        struct Received
+        {
+            Ptr<Packet> packet;
+            VpnHeader crypthdr;
+            Ptr<VpnCipher> cipher;
+            Address from;
+        };
+        std::vector<Received> m_received;        // this call of ReceivePacket, in arrival order
+        std::vector<size_t> m_batchOrder;        // m_received grouped by cipher
+        std::vector<Ptr<Packet>> m_batchPackets; // packets in m_batchOrder, decrypted in place
+        std::vector<VpnHeader> m_batchHeaders;   // their headers
+        std::unique_ptr<bool[]> m_batchOk;       // their authentication results
+        size_t m_batchOkSize;                    // capacity of m_batchOk
+        uint32_t m_receiveBudget;                // datagrams per ReceivePacket, 0 : no limit
+        EventId m_receiveEvent;                  // ReceivePacket for what the budget left in the socket
+
+        std::vector<Ptr<Packet>> m_sendQueue; // packets from the TAP device waiting for one batch encryption
+        uint32_t m_sendQueueBytes;            // bytes in m_sendQueue
+        std::vector<uint8_t> m_sendFlags;     // VpnHeader flags of the packets in m_sendQueue
+        std::vector<VpnHeader> m_sendHeaders; // their headers, filled by FlushSendQueue
+        std::vector<Ptr<Packet>> m_datagrams; // Aggregate packs m_sendQueue into these, then swaps them in
+        std::vector<uint8_t> m_datagramFlags; // their flags
+        EventId m_flushEvent;                 // pending FlushSendQueue
     };
 }
 
@@ -0,0 +1,381 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+
+// bitsliced engine of the AES class : 8 blocks are encrypted together with SSE2 logic operations only.
+// no table lookup and no branch depends on key or data, so the timing does not leak them.
+//
+// layout : plane[j] holds bit j of every state byte, byte 'pos' of a plane is state byte 'pos' and
+// its bit k belongs to block k. ShiftRows and the MixColumns rotations become byte moves inside a plane,
+// SubBytes is the Boyar-Peralta S-box circuit (113 gates) evaluated on the 8 planes.
+
+#include "vpn-aes.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define VPN_AES_BITSLICE 1
+#include <emmintrin.h>
+#define BITSLICE_TARGET __attribute__((target("sse2")))
+#endif
+
+namespace ns3
+{
+
+#ifdef VPN_AES_BITSLICE
+
+  bool AES::_hasBitslice()
+  {
+    return true;
+  }
+
+  // 8x8 bit matrix transpose : bit j of byte k <-> bit k of byte j
+  static inline uint64_t _transpose8(uint64_t x)
+  {
+    uint64_t t;
+    t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+    x = x ^ t ^ (t << 28);
+    return x;
+  }
+
+  // blocks (up to 8, missing ones are zero) -> 8 bit planes
+  BITSLICE_TARGET static void _pack(const byte *input, size_t blocks, __m128i *plane)
+  {
+    byte bytes[8][16];
+    for (uint8_t pos = 0; pos < 16; pos++)
+    {
+      uint64_t x = 0;
+      for (size_t k = 0; k < blocks; k++)
+        x |= uint64_t(input[16 * k + pos]) << (8 * k);
+      x = _transpose8(x);
+      for (uint8_t j = 0; j < 8; j++)
+        bytes[j][pos] = byte(x >> (8 * j));
+    }
+    for (uint8_t j = 0; j < 8; j++)
+      plane[j] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes[j]));
+  }
+
+  BITSLICE_TARGET static void _unpack(const __m128i *plane, byte *output, size_t blocks)
+  {
+    byte bytes[8][16];
+    for (uint8_t j = 0; j < 8; j++)
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(bytes[j]), plane[j]);
+    for (uint8_t pos = 0; pos < 16; pos++)
+    {
+      uint64_t x = 0;
+      for (uint8_t j = 0; j < 8; j++)
+        x |= uint64_t(bytes[j][pos]) << (8 * j);
+      x = _transpose8(x);
+      for (size_t k = 0; k < blocks; k++)
+        output[16 * k + pos] = byte(x >> (8 * k));
+    }
+  }
+
+  // round keys -> planes of all-zero / all-one bytes, (Nround + 1) x 8 planes
+  BITSLICE_TARGET static void _packRoundKey(const byte *roundKey, uint8_t rounds, __m128i *rk)
+  {
+    for (uint8_t i = 0; i <= rounds; i++)
+    {
+      byte bytes[16];
+      for (uint8_t j = 0; j < 8; j++)
+      {
+        for (uint8_t pos = 0; pos < 16; pos++)
+          bytes[pos] = byte(0 - ((roundKey[16 * i + pos] >> j) & 1));
+        rk[8 * i + j] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes));
+      }
+    }
+  }
+
+  BITSLICE_TARGET static inline void _addRoundKeyBS(__m128i *p, const __m128i *rk)
+  {
+    for (uint8_t j = 0; j < 8; j++)
+      p[j] = _mm_xor_si128(p[j], rk[j]);
+  }
+
+  // Boyar-Peralta forward S-box circuit, U0 / S0 are the most significant bits
+  BITSLICE_TARGET static void _subBytesBS(__m128i *p)
+  {
+#define XOR(a, b) _mm_xor_si128(a, b)
+#define AND(a, b) _mm_and_si128(a, b)
+    const __m128i ones = _mm_set1_epi32(-1);
+    __m128i U0 = p[7], U1 = p[6], U2 = p[5], U3 = p[4], U4 = p[3], U5 = p[2], U6 = p[1], U7 = p[0];
+
+    // top linear transform
+    __m128i T1 = XOR(U0, U3), T2 = XOR(U0, U5), T3 = XOR(U0, U6), T4 = XOR(U3, U5);
+    __m128i T5 = XOR(U4, U6), T6 = XOR(T1, T5), T7 = XOR(U1, U2), T8 = XOR(U7, T6);
+    __m128i T9 = XOR(U7, T7), T10 = XOR(T6, T7), T11 = XOR(U1, U5), T12 = XOR(U2, U5);
+    __m128i T13 = XOR(T3, T4), T14 = XOR(T6, T11), T15 = XOR(T5, T11), T16 = XOR(T5, T12);
+    __m128i T17 = XOR(T9, T16), T18 = XOR(U3, U7), T19 = XOR(T7, T18), T20 = XOR(T1, T19);
+    __m128i T21 = XOR(U6, U7), T22 = XOR(T7, T21), T23 = XOR(T2, T22), T24 = XOR(T2, T10);
+    __m128i T25 = XOR(T20, T17), T26 = XOR(T3, T16), T27 = XOR(T1, T12);
+
+    // shared non-linear middle part (GF(2^4) inversion)
+    __m128i M1 = AND(T13, T6), M2 = AND(T23, T8), M3 = XOR(T14, M1), M4 = AND(T19, U7);
+    __m128i M5 = XOR(M4, M1), M6 = AND(T3, T16), M7 = AND(T22, T9), M8 = XOR(T26, M6);
+    __m128i M9 = AND(T20, T17), M10 = XOR(M9, M6), M11 = AND(T1, T15), M12 = AND(T4, T27);
+    __m128i M13 = XOR(M12, M11), M14 = AND(T2, T10), M15 = XOR(M14, M11), M16 = XOR(M3, M2);
+    __m128i M17 = XOR(M5, T24), M18 = XOR(M8, M7), M19 = XOR(M10, M15), M20 = XOR(M16, M13);
+    __m128i M21 = XOR(M17, M15), M22 = XOR(M18, M13), M23 = XOR(M19, T25), M24 = XOR(M22, M23);
+    __m128i M25 = AND(M22, M20), M26 = XOR(M21, M25), M27 = XOR(M20, M21), M28 = XOR(M23, M25);
+    __m128i M29 = AND(M28, M27), M30 = AND(M26, M24), M31 = AND(M20, M23), M32 = AND(M27, M31);
+    __m128i M33 = XOR(M27, M25), M34 = AND(M21, M22), M35 = AND(M24, M34), M36 = XOR(M24, M25);
+    __m128i M37 = XOR(M21, M29), M38 = XOR(M32, M33), M39 = XOR(M23, M30), M40 = XOR(M35, M36);
+    __m128i M41 = XOR(M38, M40), M42 = XOR(M37, M39), M43 = XOR(M37, M38), M44 = XOR(M39, M40);
+    __m128i M45 = XOR(M42, M41), M46 = AND(M44, T6), M47 = AND(M40, T8), M48 = AND(M39, U7);
+    __m128i M49 = AND(M43, T16), M50 = AND(M38, T9), M51 = AND(M37, T17), M52 = AND(M42, T15);
+    __m128i M53 = AND(M45, T27), M54 = AND(M41, T10), M55 = AND(M44, T13), M56 = AND(M40, T23);
+    __m128i M57 = AND(M39, T19), M58 = AND(M43, T3), M59 = AND(M38, T22), M60 = AND(M37, T20);
+    __m128i M61 = AND(M42, T1), M62 = AND(M45, T4), M63 = AND(M41, T2);
+
+    // bottom linear transform
+    __m128i L0 = XOR(M61, M62), L1 = XOR(M50, M56), L2 = XOR(M46, M48), L3 = XOR(M47, M55);
+    __m128i L4 = XOR(M54, M58), L5 = XOR(M49, M61), L6 = XOR(M62, L5), L7 = XOR(M46, L3);
+    __m128i L8 = XOR(M51, M59), L9 = XOR(M52, M53), L10 = XOR(M53, L4), L11 = XOR(M60, L2);
+    __m128i L12 = XOR(M48, M51), L13 = XOR(M50, L0), L14 = XOR(M52, M61), L15 = XOR(M55, L1);
+    __m128i L16 = XOR(M56, L0), L17 = XOR(M57, L1), L18 = XOR(M58, L8), L19 = XOR(M63, L4);
+    __m128i L20 = XOR(L0, L1), L21 = XOR(L1, L7), L22 = XOR(L3, L12), L23 = XOR(L18, L2);
+    __m128i L24 = XOR(L15, L9), L25 = XOR(L6, L10), L26 = XOR(L7, L9), L27 = XOR(L8, L10);
+    __m128i L28 = XOR(L11, L14), L29 = XOR(L11, L17);
+
+    p[7] = XOR(L6, L24);
+    p[6] = XOR(XOR(L16, L26), ones);
+    p[5] = XOR(XOR(L19, L28), ones);
+    p[4] = XOR(L6, L21);
+    p[3] = XOR(L20, L22);
+    p[2] = XOR(L25, L29);
+    p[1] = XOR(XOR(L13, L27), ones);
+    p[0] = XOR(XOR(L6, L23), ones);
+  }
+
+  // inverse affine transform of the S-box : b'(i) = b(i+2) ^ b(i+5) ^ b(i+7) ^ 0x05(i)
+  BITSLICE_TARGET static inline void _invAffineBS(__m128i *p)
+  {
+    const __m128i ones = _mm_set1_epi32(-1);
+    __m128i b[8];
+    for (uint8_t i = 0; i < 8; i++)
+      b[i] = XOR(XOR(p[(i + 2) % 8], p[(i + 5) % 8]), p[(i + 7) % 8]);
+    b[0] = XOR(b[0], ones);
+    b[2] = XOR(b[2], ones);
+    for (uint8_t i = 0; i < 8; i++)
+      p[i] = b[i];
+  }
+
+  // InvSubBytes(x) = A^-1(SubBytes(A^-1(x))) with A^-1 the inverse affine transform
+  BITSLICE_TARGET static void _invSubBytesBS(__m128i *p)
+  {
+    _invAffineBS(p);
+    _subBytesBS(p);
+    _invAffineBS(p);
+  }
+
+  // row r of the state is byte r of every 32-bit column, rotate the columns of each row
+  BITSLICE_TARGET static inline __m128i _shiftRowsPlane(__m128i x, bool inverse)
+  {
+    const __m128i row0 = _mm_set1_epi32(0x000000ff);
+    const __m128i row1 = _mm_set1_epi32(0x0000ff00);
+    const __m128i row2 = _mm_set1_epi32(0x00ff0000);
+    const __m128i row3 = _mm_set1_epi32(0xff000000);
+    __m128i r0 = AND(x, row0);
+    __m128i r2 = _mm_shuffle_epi32(AND(x, row2), 0x4E);
+    __m128i r1, r3;
+    if (inverse)
+    {
+      r1 = _mm_shuffle_epi32(AND(x, row1), 0x93);
+      r3 = _mm_shuffle_epi32(AND(x, row3), 0x39);
+    }
+    else
+    {
+      r1 = _mm_shuffle_epi32(AND(x, row1), 0x39);
+      r3 = _mm_shuffle_epi32(AND(x, row3), 0x93);
+    }
+    return _mm_or_si128(_mm_or_si128(r0, r1), _mm_or_si128(r2, r3));
+  }
+
+  BITSLICE_TARGET static inline void _shiftRowsBS(__m128i *p, bool inverse)
+  {
+    for (uint8_t j = 0; j < 8; j++)
+      p[j] = _shiftRowsPlane(p[j], inverse);
+  }
+
+  // byte r of each column <- byte r + n of the same column
+#define ROT(x, n) _mm_or_si128(_mm_srli_epi32(x, 8 * (n)), _mm_slli_epi32(x, 32 - 8 * (n)))
+
+  // multiply every byte by 2 in GF(2^8) : bit shift across planes, reduction by 0x1b
+  BITSLICE_TARGET static inline void _xtimeBS(const __m128i *t, __m128i *out)
+  {
+    out[0] = t[7];
+    out[1] = XOR(t[0], t[7]);
+    out[2] = t[1];
+    out[3] = XOR(t[2], t[7]);
+    out[4] = XOR(t[3], t[7]);
+    out[5] = t[4];
+    out[6] = t[5];
+    out[7] = t[6];
+  }
+
+  // out(r) = 2 a(r) ^ 3 a(r+1) ^ a(r+2) ^ a(r+3) = 2 (a(r) ^ a(r+1)) ^ a(r+1) ^ a(r+2) ^ a(r+3)
+  BITSLICE_TARGET static void _mixColumnsBS(__m128i *p)
+  {
+    __m128i t[8], r1[8], x[8];
+    for (uint8_t j = 0; j < 8; j++)
+    {
+      r1[j] = ROT(p[j], 1);
+      t[j] = XOR(p[j], r1[j]);
+    }
+    _xtimeBS(t, x);
+    for (uint8_t j = 0; j < 8; j++)
+      p[j] = XOR(XOR(x[j], r1[j]), ROT(t[j], 2)); // a(r+2) ^ a(r+3) = rot2(a ^ rot1(a))
+  }
+
+  // InvMixColumns = MixColumns after a(r) ^= 4 (a(r) ^ a(r+2))
+  BITSLICE_TARGET static void _invMixColumnsBS(__m128i *p)
+  {
+    __m128i t[8], x[8], y[8];
+    for (uint8_t j = 0; j < 8; j++)
+      t[j] = XOR(p[j], ROT(p[j], 2));
+    _xtimeBS(t, x);
+    _xtimeBS(x, y);
+    for (uint8_t j = 0; j < 8; j++)
+      p[j] = XOR(p[j], y[j]);
+    _mixColumnsBS(p);
+  }
+
+#undef ROT
+
+  BITSLICE_TARGET static void _encrypt8(__m128i *p, const __m128i *rk, uint8_t rounds)
+  {
+    _addRoundKeyBS(p, rk);
+    for (uint8_t i = 1; i < rounds; i++)
+    {
+      _subBytesBS(p);
+      _shiftRowsBS(p, false);
+      _mixColumnsBS(p);
+      _addRoundKeyBS(p, rk + 8 * i);
+    }
+    _subBytesBS(p);
+    _shiftRowsBS(p, false);
+    _addRoundKeyBS(p, rk + 8 * rounds);
+  }
+
+  BITSLICE_TARGET static void _decrypt8(__m128i *p, const __m128i *rk, uint8_t rounds)
+  {
+    _addRoundKeyBS(p, rk + 8 * rounds);
+    for (uint8_t i = rounds - 1; i > 0; i--)
+    {
+      _shiftRowsBS(p, true);
+      _invSubBytesBS(p);
+      _addRoundKeyBS(p, rk + 8 * i);
+      _invMixColumnsBS(p);
+    }
+    _shiftRowsBS(p, true);
+    _invSubBytesBS(p);
+    _addRoundKeyBS(p, rk);
+  }
+
+#undef XOR
+#undef AND
+
+  BITSLICE_TARGET void AES::_ecbEncryptBS(const byte *input, byte *output, size_t blocks, const byte *roundKey) const
+  {
+    __m128i rk[8 * 15];
+    _packRoundKey(roundKey, this->Nround_, rk);
+
+    for (size_t i = 0; i < blocks; i += 8)
+    {
+      size_t n = std::min(blocks - i, static_cast<size_t>(8));
+      __m128i p[8];
+      _pack(input + 16 * i, n, p);
+      _encrypt8(p, rk, this->Nround_);
+      _unpack(p, output + 16 * i, n);
+    }
+  }
+
+  BITSLICE_TARGET void AES::_ecbDecryptBS(const byte *input, byte *output, size_t blocks, const byte *roundKey) const
+  {
+    __m128i rk[8 * 15];
+    _packRoundKey(roundKey, this->Nround_, rk);
+
+    for (size_t i = 0; i < blocks; i += 8)
+    {
+      size_t n = std::min(blocks - i, static_cast<size_t>(8));
+      __m128i p[8];
+      _pack(input + 16 * i, n, p);
+      _decrypt8(p, rk, this->Nround_);
+      _unpack(p, output + 16 * i, n);
+    }
+  }
+
+  BITSLICE_TARGET void AES::_cbcEncryptBS(const byte *input, byte *output, size_t blocks, const byte *roundKey, byte *chain) const
+  {
+    __m128i rk[8 * 15];
+    _packRoundKey(roundKey, this->Nround_, rk);
+
+    // CBC encryption is serial, only one of the 8 lanes carries data
+    for (size_t i = 0; i < blocks; i++)
+    {
+      byte state[16];
+      for (uint8_t j = 0; j < 16; j++)
+        state[j] = input[16 * i + j] ^ chain[j];
+      __m128i p[8];
+      _pack(state, 1, p);
+      _encrypt8(p, rk, this->Nround_);
+      _unpack(p, chain, 1);
+      memcpy(output + 16 * i, chain, 16);
+    }
+  }
+
+  BITSLICE_TARGET void AES::_cbcDecryptBS(const byte *input, byte *output, size_t blocks, const byte *roundKey, byte *chain) const
+  {
+    __m128i rk[8 * 15];
+    _packRoundKey(roundKey, this->Nround_, rk);
+
+    for (size_t i = 0; i < blocks; i += 8)
+    {
+      size_t n = std::min(blocks - i, static_cast<size_t>(8));
+      byte prev[8 * 16]; // cipher blocks are kept since output may overwrite input (in-place)
+      memcpy(prev, chain, 16);
+      memcpy(prev + 16, input + 16 * i, 16 * (n - 1));
+      memcpy(chain, input + 16 * (i + n - 1), 16);
+
+      __m128i p[8];
+      _pack(input + 16 * i, n, p);
+      _decrypt8(p, rk, this->Nround_);
+      _unpack(p, output + 16 * i, n);
+      for (size_t j = 0; j < 16 * n; j++)
+        output[16 * i + j] ^= prev[j];
+    }
+  }
+
+#else // VPN_AES_BITSLICE
+
+  bool AES::_hasBitslice()
+  {
+    return false;
+  }
+
+  void AES::_ecbEncryptBS(const byte *, byte *, size_t, const byte *) const
+  {
+    assert(false && "bitsliced AES needs SSE2");
+  }
+
+  void AES::_ecbDecryptBS(const byte *, byte *, size_t, const byte *) const
+  {
+    assert(false && "bitsliced AES needs SSE2");
+  }
+
+  void AES::_cbcEncryptBS(const byte *, byte *, size_t, const byte *, byte *) const
+  {
+    assert(false && "bitsliced AES needs SSE2");
+  }
+
+  void AES::_cbcDecryptBS(const byte *, byte *, size_t, const byte *, byte *) const
+  {
+    assert(false && "bitsliced AES needs SSE2");
+  }
+
+#endif // VPN_AES_BITSLICE
+
+}
@@ -0,0 +1,301 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+
+// AES-NI engine and PCLMULQDQ GHASH of the AES class. functions are compiled for these instruction sets
+// with the target attribute, so the rest of the module keeps building for the baseline CPU. they are only
+// called after AES::_hasAESNI() / AES::_hasCLMUL() confirmed the instructions through CPUID.
+
+#include "vpn-aes.h"
+#include <cassert>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define VPN_AES_NI 1
+#include <cpuid.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+#define AESNI_TARGET __attribute__((target("aes,sse2")))
+#define CLMUL_TARGET __attribute__((target("pclmul,ssse3")))
+#endif
+
+namespace ns3
+{
+
+#ifdef VPN_AES_NI
+
+  bool AES::_hasAESNI()
+  {
+    static const bool supported = []() {
+      unsigned int eax, ebx, ecx, edx;
+      if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+      return (ecx & bit_AES) != 0 && (edx & bit_SSE2) != 0;
+    }();
+    return supported;
+  }
+
+  // encrypt 4 independent blocks at once to keep the AESENC pipeline busy
+  AESNI_TARGET static inline void
+  _encrypt4(__m128i &b0, __m128i &b1, __m128i &b2, __m128i &b3, const __m128i *rk, uint8_t rounds)
+  {
+    b0 = _mm_xor_si128(b0, rk[0]);
+    b1 = _mm_xor_si128(b1, rk[0]);
+    b2 = _mm_xor_si128(b2, rk[0]);
+    b3 = _mm_xor_si128(b3, rk[0]);
+    for (uint8_t i = 1; i < rounds; i++)
+    {
+      b0 = _mm_aesenc_si128(b0, rk[i]);
+      b1 = _mm_aesenc_si128(b1, rk[i]);
+      b2 = _mm_aesenc_si128(b2, rk[i]);
+      b3 = _mm_aesenc_si128(b3, rk[i]);
+    }
+    b0 = _mm_aesenclast_si128(b0, rk[rounds]);
+    b1 = _mm_aesenclast_si128(b1, rk[rounds]);
+    b2 = _mm_aesenclast_si128(b2, rk[rounds]);
+    b3 = _mm_aesenclast_si128(b3, rk[rounds]);
+  }
+
+  AESNI_TARGET static inline __m128i _encrypt1(__m128i b, const __m128i *rk, uint8_t rounds)
+  {
+    b = _mm_xor_si128(b, rk[0]);
+    for (uint8_t i = 1; i < rounds; i++)
+      b = _mm_aesenc_si128(b, rk[i]);
+    return _mm_aesenclast_si128(b, rk[rounds]);
+  }
+
+  AESNI_TARGET static inline void
+  _decrypt4(__m128i &b0, __m128i &b1, __m128i &b2, __m128i &b3, const __m128i *dk, uint8_t rounds)
+  {
+    b0 = _mm_xor_si128(b0, dk[0]);
+    b1 = _mm_xor_si128(b1, dk[0]);
+    b2 = _mm_xor_si128(b2, dk[0]);
+    b3 = _mm_xor_si128(b3, dk[0]);
+    for (uint8_t i = 1; i < rounds; i++)
+    {
+      b0 = _mm_aesdec_si128(b0, dk[i]);
+      b1 = _mm_aesdec_si128(b1, dk[i]);
+      b2 = _mm_aesdec_si128(b2, dk[i]);
+      b3 = _mm_aesdec_si128(b3, dk[i]);
+    }
+    b0 = _mm_aesdeclast_si128(b0, dk[rounds]);
+    b1 = _mm_aesdeclast_si128(b1, dk[rounds]);
+    b2 = _mm_aesdeclast_si128(b2, dk[rounds]);
+    b3 = _mm_aesdeclast_si128(b3, dk[rounds]);
+  }
+
+  AESNI_TARGET static inline __m128i _decrypt1(__m128i b, const __m128i *dk, uint8_t rounds)
+  {
+    b = _mm_xor_si128(b, dk[0]);
+    for (uint8_t i = 1; i < rounds; i++)
+      b = _mm_aesdec_si128(b, dk[i]);
+    return _mm_aesdeclast_si128(b, dk[rounds]);
+  }
+
+  AESNI_TARGET static inline void _loadRoundKey(const byte *roundKey, __m128i *rk, uint8_t rounds)
+  {
+    for (uint8_t i = 0; i <= rounds; i++)
+      rk[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(roundKey + 16 * i));
+  }
+
+#define LOAD(p, i) _mm_loadu_si128(reinterpret_cast<const __m128i *>((p) + 16 * (i)))
+#define STORE(p, i, v) _mm_storeu_si128(reinterpret_cast<__m128i *>((p) + 16 * (i)), (v))
+
+  AESNI_TARGET void AES::_ecbEncryptNI(const byte *input, byte *output, size_t blocks, const byte *roundKey) const
+  {
+    __m128i rk[15];
+    _loadRoundKey(roundKey, rk, this->Nround_);
+
+    size_t i = 0;
+    for (; i + 4 <= blocks; i += 4)
+    {
+      __m128i b0 = LOAD(input, i), b1 = LOAD(input, i + 1), b2 = LOAD(input, i + 2), b3 = LOAD(input, i + 3);
+      _encrypt4(b0, b1, b2, b3, rk, this->Nround_);
+      STORE(output, i, b0);
+      STORE(output, i + 1, b1);
+      STORE(output, i + 2, b2);
+      STORE(output, i + 3, b3);
+    }
+    for (; i < blocks; i++)
+    {
+      STORE(output, i, _encrypt1(LOAD(input, i), rk, this->Nround_));
+    }
+  }
+
+  // invRoundKey is already in AESDEC order (AESKey::getInvRoundKey), no AESIMC per call
+  AESNI_TARGET void AES::_ecbDecryptNI(const byte *input, byte *output, size_t blocks, const byte *invRoundKey) const
+  {
+    __m128i dk[15];
+    _loadRoundKey(invRoundKey, dk, this->Nround_);
+
+    size_t i = 0;
+    for (; i + 4 <= blocks; i += 4)
+    {
+      __m128i b0 = LOAD(input, i), b1 = LOAD(input, i + 1), b2 = LOAD(input, i + 2), b3 = LOAD(input, i + 3);
+      _decrypt4(b0, b1, b2, b3, dk, this->Nround_);
+      STORE(output, i, b0);
+      STORE(output, i + 1, b1);
+      STORE(output, i + 2, b2);
+      STORE(output, i + 3, b3);
+    }
+    for (; i < blocks; i++)
+    {
+      STORE(output, i, _decrypt1(LOAD(input, i), dk, this->Nround_));
+    }
+  }
+
+  AESNI_TARGET void AES::_cbcEncryptNI(const byte *input, byte *output, size_t blocks, const byte *roundKey, byte *chain) const
+  {
+    __m128i rk[15];
+    _loadRoundKey(roundKey, rk, this->Nround_);
+
+    // CBC encryption is serial : every block depends on the previous cipher block
+    __m128i prev = LOAD(chain, 0);
+    for (size_t i = 0; i < blocks; i++)
+    {
+      prev = _encrypt1(_mm_xor_si128(LOAD(input, i), prev), rk, this->Nround_);
+      STORE(output, i, prev);
+    }
+    STORE(chain, 0, prev);
+  }
+
+  AESNI_TARGET void AES::_cbcDecryptNI(const byte *input, byte *output, size_t blocks, const byte *invRoundKey, byte *chain) const
+  {
+    __m128i dk[15];
+    _loadRoundKey(invRoundKey, dk, this->Nround_);
+
+    __m128i prev = LOAD(chain, 0);
+    size_t i = 0;
+    for (; i + 4 <= blocks; i += 4)
+    {
+      __m128i c0 = LOAD(input, i), c1 = LOAD(input, i + 1), c2 = LOAD(input, i + 2), c3 = LOAD(input, i + 3);
+      __m128i b0 = c0, b1 = c1, b2 = c2, b3 = c3;
+      _decrypt4(b0, b1, b2, b3, dk, this->Nround_);
+      STORE(output, i, _mm_xor_si128(b0, prev));
+      STORE(output, i + 1, _mm_xor_si128(b1, c0));
+      STORE(output, i + 2, _mm_xor_si128(b2, c1));
+      STORE(output, i + 3, _mm_xor_si128(b3, c2));
+      prev = c3;
+    }
+    for (; i < blocks; i++)
+    {
+      __m128i c = LOAD(input, i);
+      STORE(output, i, _mm_xor_si128(_decrypt1(c, dk, this->Nround_), prev));
+      prev = c;
+    }
+    STORE(chain, 0, prev);
+  }
+
+  bool AES::_hasCLMUL()
+  {
+    static const bool supported = []() {
+      unsigned int eax, ebx, ecx, edx;
+      if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+      return (ecx & bit_PCLMUL) != 0 && (ecx & bit_SSSE3) != 0;
+    }();
+    return supported;
+  }
+
+  // carry-less multiplication in GF(2^128) on byte-reflected operands, then reduction modulo
+  // x^128 + x^7 + x^2 + x + 1 (Intel carry-less multiplication white paper, algorithm 1 + 5)
+  CLMUL_TARGET static inline __m128i _gfmul(__m128i a, __m128i b)
+  {
+    __m128i t3 = _mm_clmulepi64_si128(a, b, 0x00);
+    __m128i t4 = _mm_clmulepi64_si128(a, b, 0x10);
+    __m128i t5 = _mm_clmulepi64_si128(a, b, 0x01);
+    __m128i t6 = _mm_clmulepi64_si128(a, b, 0x11);
+
+    t4 = _mm_xor_si128(t4, t5);
+    t5 = _mm_slli_si128(t4, 8);
+    t4 = _mm_srli_si128(t4, 8);
+    t3 = _mm_xor_si128(t3, t5);
+    t6 = _mm_xor_si128(t6, t4);
+
+    // shift the 256 bits product left by one (bit reflection)
+    __m128i t7 = _mm_srli_epi32(t3, 31);
+    __m128i t8 = _mm_srli_epi32(t6, 31);
+    t3 = _mm_slli_epi32(t3, 1);
+    t6 = _mm_slli_epi32(t6, 1);
+    __m128i t9 = _mm_srli_si128(t7, 12);
+    t8 = _mm_slli_si128(t8, 4);
+    t7 = _mm_slli_si128(t7, 4);
+    t3 = _mm_or_si128(t3, t7);
+    t6 = _mm_or_si128(t6, t8);
+    t6 = _mm_or_si128(t6, t9);
+
+    // reduction
+    t7 = _mm_slli_epi32(t3, 31);
+    t8 = _mm_slli_epi32(t3, 30);
+    t9 = _mm_slli_epi32(t3, 25);
+    t7 = _mm_xor_si128(t7, t8);
+    t7 = _mm_xor_si128(t7, t9);
+    t8 = _mm_srli_si128(t7, 4);
+    t7 = _mm_slli_si128(t7, 12);
+    t3 = _mm_xor_si128(t3, t7);
+
+    __m128i t2 = _mm_srli_epi32(t3, 1);
+    t4 = _mm_srli_epi32(t3, 2);
+    t5 = _mm_srli_epi32(t3, 7);
+    t2 = _mm_xor_si128(t2, t4);
+    t2 = _mm_xor_si128(t2, t5);
+    t2 = _mm_xor_si128(t2, t8);
+    t3 = _mm_xor_si128(t3, t2);
+    return _mm_xor_si128(t6, t3);
+  }
+
+  CLMUL_TARGET void AES::_ghashCLMUL(byte *x, const byte *h, const byte *blocks, size_t count) const
+  {
+    const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i hv = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(h)), bswap);
+    __m128i xv = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(x)), bswap);
+
+    for (size_t i = 0; i < count; i++)
+    {
+      __m128i d = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(blocks + 16 * i)), bswap);
+      xv = _gfmul(_mm_xor_si128(xv, d), hv);
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(x), _mm_shuffle_epi8(xv, bswap));
+  }
+
+#undef LOAD
+#undef STORE
+
+#else // VPN_AES_NI
+
+  bool AES::_hasAESNI()
+  {
+    return false;
+  }
+
+  bool AES::_hasCLMUL()
+  {
+    return false;
+  }
+
+  void AES::_ghashCLMUL(byte *, const byte *, const byte *, size_t) const
+  {
+    assert(false && "PCLMULQDQ is not available on this platform");
+  }
+
+  void AES::_ecbEncryptNI(const byte *, byte *, size_t, const byte *) const
+  {
+    assert(false && "AES-NI is not available on this platform");
+  }
+
+  void AES::_ecbDecryptNI(const byte *, byte *, size_t, const byte *) const
+  {
+    assert(false && "AES-NI is not available on this platform");
+  }
+
+  void AES::_cbcEncryptNI(const byte *, byte *, size_t, const byte *, byte *) const
+  {
+    assert(false && "AES-NI is not available on this platform");
+  }
+
+  void AES::_cbcDecryptNI(const byte *, byte *, size_t, const byte *, byte *) const
+  {
+    assert(false && "AES-NI is not available on this platform");
+  }
+
+#endif // VPN_AES_NI
+
+}
@@ -1,57 +1,234 @@
 /* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
 
 #include "vpn-aes.h"
+#include "vpn-thread-pool.h"
 #include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <cctype>
 #include <random>
 #include <time.h>
 
 #define multiply(a) (((a) << 1) ^ (((a >> 7) & 1) * 0x1b))
+#define GETU32(p) ((uint32_t(p[0]) << 24) ^ (uint32_t(p[1]) << 16) ^ (uint32_t(p[2]) << 8) ^ uint32_t(p[3]))
+#define PUTU32(p, v) ((p)[0] = byte((v) >> 24), (p)[1] = byte((v) >> 16), (p)[2] = byte((v) >> 8), (p)[3] = byte(v))
 
 namespace ns3
 {
 
-  AES::AES(size_t keyBits, MODE mode) : Nkey_(keyBits / 32), Nround_(6 + this->Nkey_), mode_(mode)
+  // InvMixColumns of one column : multiply by {04}x^2 + {05} first, then by the MixColumns polynomial
+  static void
+  invMixColumn(byte *col)
+  {
+    byte u = multiply(byte(multiply(byte(col[0] ^ col[2]))));
+    byte v = multiply(byte(multiply(byte(col[1] ^ col[3]))));
+    col[0] ^= u;
+    col[1] ^= v;
+    col[2] ^= u;
+    col[3] ^= v;
+
+    byte all = col[0] ^ col[1] ^ col[2] ^ col[3];
+    byte first = col[0];
+    col[0] ^= all ^ byte(multiply(byte(col[0] ^ col[1])));
+    col[1] ^= all ^ byte(multiply(byte(col[1] ^ col[2])));
+    col[2] ^= all ^ byte(multiply(byte(col[2] ^ col[3])));
+    col[3] ^= all ^ byte(multiply(byte(col[3] ^ first)));
+  }
+
+  const size_t AES::CTR_GROUP;
+
+  const byte AES::sbox_[256] = {
+      0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+      0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+      0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+      0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+      0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+      0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+      0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+      0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+      0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+      0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+      0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+      0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+      0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+      0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+      0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+      0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16};
+
+  const byte AES::inv_sbox_[256] = {
+      0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb,
+      0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87, 0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb,
+      0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e,
+      0x08, 0x2e, 0xa1, 0x66, 0x28, 0xd9, 0x24, 0xb2, 0x76, 0x5b, 0xa2, 0x49, 0x6d, 0x8b, 0xd1, 0x25,
+      0x72, 0xf8, 0xf6, 0x64, 0x86, 0x68, 0x98, 0x16, 0xd4, 0xa4, 0x5c, 0xcc, 0x5d, 0x65, 0xb6, 0x92,
+      0x6c, 0x70, 0x48, 0x50, 0xfd, 0xed, 0xb9, 0xda, 0x5e, 0x15, 0x46, 0x57, 0xa7, 0x8d, 0x9d, 0x84,
+      0x90, 0xd8, 0xab, 0x00, 0x8c, 0xbc, 0xd3, 0x0a, 0xf7, 0xe4, 0x58, 0x05, 0xb8, 0xb3, 0x45, 0x06,
+      0xd0, 0x2c, 0x1e, 0x8f, 0xca, 0x3f, 0x0f, 0x02, 0xc1, 0xaf, 0xbd, 0x03, 0x01, 0x13, 0x8a, 0x6b,
+      0x3a, 0x91, 0x11, 0x41, 0x4f, 0x67, 0xdc, 0xea, 0x97, 0xf2, 0xcf, 0xce, 0xf0, 0xb4, 0xe6, 0x73,
+      0x96, 0xac, 0x74, 0x22, 0xe7, 0xad, 0x35, 0x85, 0xe2, 0xf9, 0x37, 0xe8, 0x1c, 0x75, 0xdf, 0x6e,
+      0x47, 0xf1, 0x1a, 0x71, 0x1d, 0x29, 0xc5, 0x89, 0x6f, 0xb7, 0x62, 0x0e, 0xaa, 0x18, 0xbe, 0x1b,
+      0xfc, 0x56, 0x3e, 0x4b, 0xc6, 0xd2, 0x79, 0x20, 0x9a, 0xdb, 0xc0, 0xfe, 0x78, 0xcd, 0x5a, 0xf4,
+      0x1f, 0xdd, 0xa8, 0x33, 0x88, 0x07, 0xc7, 0x31, 0xb1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xec, 0x5f,
+      0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d, 0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef,
+      0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61,
+      0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d};
+
+  const byte AES::rcon_[11] = {
+      0xFF, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36};
+
+  // T-tables : Te[n][x] is the MixColumns column of SubBytes(x) rotated by n bytes, Td likewise for the inverse cipher.
+  // built once from the S-boxes when the module is loaded
+  struct AESTTables
+  {
+    uint32_t Te[4][256];
+    uint32_t Td[4][256];
+
+    AESTTables()
+    {
+      for (uint32_t x = 0; x < 256; x++)
+      {
+        byte s = AES::sbox_[x];
+        byte s2 = multiply(s);
+        byte s3 = s2 ^ s;
+        uint32_t te = (uint32_t(s2) << 24) | (uint32_t(s) << 16) | (uint32_t(s) << 8) | s3;
+
+        byte is = AES::inv_sbox_[x];
+        byte is2 = multiply(is);
+        byte is4 = multiply(is2);
+        byte is8 = multiply(is4);
+        byte is9 = is8 ^ is;
+        byte is11 = is8 ^ is2 ^ is;
+        byte is13 = is8 ^ is4 ^ is;
+        byte is14 = is8 ^ is4 ^ is2;
+        uint32_t td = (uint32_t(is14) << 24) | (uint32_t(is9) << 16) | (uint32_t(is13) << 8) | is11;
+
+        for (uint8_t n = 0; n < 4; n++)
+        {
+          this->Te[n][x] = n ? (te >> (8 * n)) | (te << (32 - 8 * n)) : te;
+          this->Td[n][x] = n ? (td >> (8 * n)) | (td << (32 - 8 * n)) : td;
+        }
+      }
+    }
+  };
+
+  static const AESTTables g_tables;
+
+  AES::AES(size_t keyBits, MODE mode, ENGINE engine) : Nkey_(keyBits / 32), Nround_(6 + this->Nkey_), mode_(mode)
   {
     assert(keyBits == 128 || keyBits == 192 || keyBits == 256);
+    this->setEngine(engine);
 
-    if (mode == MODE::CBC)
+    if (mode != MODE::ECB)
     {
       this->iv_.assign(this->Nstate_, 0);
+    }
+    // CTR / GCM take their iv per call, only CBC gets a default one (setIV reseeds the C library generator)
+    if (mode == MODE::CBC)
+    {
       this->setIV(time(NULL));
     }
   }
 
-  std::vector<byte> AES::_createState(const std::vector<byte> &block, uint32_t start)
+  void AES::setEngine(ENGINE engine)
+  {
+    if (engine == ENGINE::AUTO || (engine == ENGINE::AESNI && !AES::_hasAESNI()))
+    {
+      // the table engine indexes its lookups with key dependent bytes, it is the last resort
+      engine = AES::_hasAESNI() ? ENGINE::AESNI : ENGINE::BITSLICE;
+    }
+    if (engine == ENGINE::BITSLICE && !AES::_hasBitslice())
+    {
+      engine = ENGINE::TTABLE;
+    }
+    this->engine_ = engine;
+  }
+
+  ENGINE AES::getEngine() const
   {
-    uint8_t last = std::min(this->Nstate_, static_cast<uint8_t>(block.size() - start));
+    return this->engine_;
+  }
+
+  void AES::_createState(byte *state, const byte *block, size_t length) const
+  {
+    uint8_t last = static_cast<uint8_t>(std::min(static_cast<size_t>(this->Nstate_), length));
     byte init_val = 0;
     if (last != this->Nstate_)
       init_val = this->Nstate_ - last; // using PKCS#7 padding
-    std::vector<byte> ret(this->Nstate_, init_val);
 
-    for (uint8_t i = start; i < start + last; i++)
+    for (uint8_t i = 0; i < last; i++)
+    {
+      state[i] = block[i];
+    }
+    for (uint8_t i = last; i < this->Nstate_; i++)
     {
-      ret[i - start] = block[i];
+      state[i] = init_val;
     }
+  }
 
-    return ret;
+  AESKey::AESKey() : Nkey_(0), Nround_(0)
+  {
   }
 
-  std::vector<byte> AES::_expandKey(const std::vector<byte> &cipherKey, bool verbose)
+  AESKey::AESKey(const std::string &cipherKey) : Nkey_(0), Nround_(0)
+  {
+    // 128 / 192 / 256 bits * 2 hex characters, anything else leaves the key invalid
+    if (cipherKey.size() != 32 && cipherKey.size() != 48 && cipherKey.size() != 64)
+      return;
+    std::vector<byte> key = AES::_convertTypeStrToByteBlock(cipherKey);
+    if (key.size() != cipherKey.size() / 2)
+      return;
+
+    this->Nkey_ = cipherKey.size() / 8;
+    this->Nround_ = 6 + this->Nkey_;
+    this->_expandKey(key.data());
+  }
+
+  AESKey::AESKey(const byte *cipherKey, size_t keyBits) : Nkey_(keyBits / 32), Nround_(6 + this->Nkey_)
+  {
+    assert(keyBits == 128 || keyBits == 192 || keyBits == 256);
+    this->_expandKey(cipherKey);
+  }
+
+  bool AESKey::isValid() const
+  {
+    return this->Nkey_ != 0;
+  }
+
+  size_t AESKey::getKeyBits() const
+  {
+    return this->Nkey_ * 32;
+  }
+
+  uint8_t AESKey::getRounds() const
+  {
+    return this->Nround_;
+  }
+
+  const byte *AESKey::getRoundKey() const
+  {
+    return this->roundKey_;
+  }
+
+  const byte *AESKey::getInvRoundKey() const
+  {
+    return this->invRoundKey_;
+  }
+
+  void AESKey::_expandKey(const byte *cipherKey)
   {
     // expand key : Nstate x (Nround + 1) array
-    std::vector<byte> roundKey(this->Nstate_ * (this->Nround_ + 1), 0);
+    const uint8_t Ncol = 4; // the column size of state matrix
+    byte *roundKey = this->roundKey_;
 
     for (uint8_t i = 0; i < this->Nkey_; i++)
     {
-      roundKey[(i * this->Ncol_) + 0] = cipherKey[(i * this->Ncol_) + 0];
-      roundKey[(i * this->Ncol_) + 1] = cipherKey[(i * this->Ncol_) + 1];
-      roundKey[(i * this->Ncol_) + 2] = cipherKey[(i * this->Ncol_) + 2];
-      roundKey[(i * this->Ncol_) + 3] = cipherKey[(i * this->Ncol_) + 3];
+      roundKey[(i * Ncol) + 0] = cipherKey[(i * Ncol) + 0];
+      roundKey[(i * Ncol) + 1] = cipherKey[(i * Ncol) + 1];
+      roundKey[(i * Ncol) + 2] = cipherKey[(i * Ncol) + 2];
+      roundKey[(i * Ncol) + 3] = cipherKey[(i * Ncol) + 3];
     }
 
-    for (uint8_t i = this->Nkey_; i < this->Ncol_ * (this->Nround_ + 1); i++)
+    for (uint8_t i = this->Nkey_; i < Ncol * (this->Nround_ + 1); i++)
     {
       byte Wi_1[4];
       uint8_t i_1 = (i - 1) * 4;
@@ -71,55 +248,68 @@ namespace ns3
         Wi_1[3] = temp;
 
         // SubBytes
-        Wi_1[0] = this->_mappingSBox(Wi_1[0]);
-        Wi_1[1] = this->_mappingSBox(Wi_1[1]);
-        Wi_1[2] = this->_mappingSBox(Wi_1[2]);
-        Wi_1[3] = this->_mappingSBox(Wi_1[3]);
+        Wi_1[0] = AES::sbox_[Wi_1[0]];
+        Wi_1[1] = AES::sbox_[Wi_1[1]];
+        Wi_1[2] = AES::sbox_[Wi_1[2]];
+        Wi_1[3] = AES::sbox_[Wi_1[3]];
 
         // XOR Rcon
-        Wi_1[0] = Wi_1[0] ^ rcon_[i / this->Nkey_];
+        Wi_1[0] = Wi_1[0] ^ AES::rcon_[i / this->Nkey_];
       }
 
       if (this->Nkey_ == 8) // if AES256
       {
         if (i % this->Nkey_ == 4)
         {
-          Wi_1[0] = this->_mappingSBox(Wi_1[0]);
-          Wi_1[1] = this->_mappingSBox(Wi_1[1]);
-          Wi_1[2] = this->_mappingSBox(Wi_1[2]);
-          Wi_1[3] = this->_mappingSBox(Wi_1[3]);
+          Wi_1[0] = AES::sbox_[Wi_1[0]];
+          Wi_1[1] = AES::sbox_[Wi_1[1]];
+          Wi_1[2] = AES::sbox_[Wi_1[2]];
+          Wi_1[3] = AES::sbox_[Wi_1[3]];
         }
       }
 
       uint8_t i_4 = (i - this->Nkey_) * 4;
-      roundKey[(i * this->Ncol_) + 0] = roundKey[i_4 + 0] ^ Wi_1[0];
-      roundKey[(i * this->Ncol_) + 1] = roundKey[i_4 + 1] ^ Wi_1[1];
-      roundKey[(i * this->Ncol_) + 2] = roundKey[i_4 + 2] ^ Wi_1[2];
-      roundKey[(i * this->Ncol_) + 3] = roundKey[i_4 + 3] ^ Wi_1[3];
+      roundKey[(i * Ncol) + 0] = roundKey[i_4 + 0] ^ Wi_1[0];
+      roundKey[(i * Ncol) + 1] = roundKey[i_4 + 1] ^ Wi_1[1];
+      roundKey[(i * Ncol) + 2] = roundKey[i_4 + 2] ^ Wi_1[2];
+      roundKey[(i * Ncol) + 3] = roundKey[i_4 + 3] ^ Wi_1[3];
     }
 
-    if (verbose)
+    // equivalent inverse cipher (FIPS-197 5.3.5) : decryption then runs the same round structure as encryption,
+    // so the table and AES-NI engines do not transform the key on every call
+    for (uint8_t round = 0; round <= this->Nround_; round++)
     {
-      for (uint8_t i = 0; i < this->Nround_ + 1; i++)
+      const byte *rk = roundKey + (this->Nround_ - round) * 16;
+      byte *dk = this->invRoundKey_ + round * 16;
+      std::copy(rk, rk + 16, dk);
+      if (round != 0 && round != this->Nround_)
       {
-        printf("\n----- Round Key %d ----\n", i);
+        for (uint8_t c = 0; c < Ncol; c++)
+          invMixColumn(dk + c * 4);
+      }
+    }
+  }
+
+  void AES::_printRoundKey(const AESKey &key) const
+  {
+    const byte *roundKey = key.getRoundKey();
+    for (uint8_t i = 0; i < this->Nround_ + 1; i++)
+    {
+      printf("\n----- Round Key %d ----\n", i);
 
-        for (uint8_t r = 0; r < this->Bsize_; r++)
+      for (uint8_t r = 0; r < this->Bsize_; r++)
+      {
+        printf("      ");
+        for (uint8_t c = 0; c < this->Ncol_; c++)
         {
-          printf("      ");
-          for (uint8_t c = 0; c < this->Ncol_; c++)
-          {
-            printf("%02X ", roundKey[(i * this->Nstate_) + (c * this->Ncol_) + r]);
-          }
-          printf("\n");
+          printf("%02X ", roundKey[(i * this->Nstate_) + (c * this->Ncol_) + r]);
         }
+        printf("\n");
       }
     }
-
-    return roundKey;
   }
 
-  void AES::_addRoundKey(std::vector<byte> &state, const std::vector<byte> &roundKey, uint8_t round, bool verbose)
+  void AES::_addRoundKey(byte *state, const byte *roundKey, uint8_t round, bool verbose) const
   {
     for (uint8_t i = 0; i < this->Nstate_; i++)
     {
@@ -133,7 +323,7 @@ namespace ns3
     }
   }
 
-  void AES::_xor_iv(std::vector<byte> &state, std::vector<byte> &iv, bool verbose)
+  void AES::_xor_iv(byte *state, const byte *iv, bool verbose) const
   {
     for (uint8_t i = 0; i < this->Nstate_; i++)
       state[i] ^= iv[i];
@@ -145,7 +335,7 @@ namespace ns3
     }
   }
 
-  void AES::_encryption(std::vector<byte> &state, const std::vector<byte> &roundKey, bool verbose)
+  void AES::_encryption(byte *state, const byte *roundKey, bool verbose) const
   {
     this->_addRoundKey(state, roundKey, 0, verbose);
     for (uint8_t i = 1; i < this->Nround_; i++)
@@ -160,12 +350,12 @@ namespace ns3
     this->_addRoundKey(state, roundKey, this->Nround_, verbose);
   }
 
-  byte AES::_mappingSBox(const byte val)
+  byte AES::_mappingSBox(const byte val) const
   {
     return this->sbox_[val];
   }
 
-  void AES::_subBytes(std::vector<byte> &state, bool verbose)
+  void AES::_subBytes(byte *state, bool verbose) const
   {
     for (uint8_t i = 0; i < this->Nstate_; i++)
     {
@@ -179,7 +369,7 @@ namespace ns3
     }
   }
 
-  void AES::_shiftRows(std::vector<byte> &state, bool verbose)
+  void AES::_shiftRows(byte *state, bool verbose) const
   {
     byte temp;
     // Rotate row 1
@@ -211,9 +401,9 @@ namespace ns3
     }
   }
 
-  void AES::_mixColumns(std::vector<byte> &state, bool verbose)
+  void AES::_mixColumns(byte *state, bool verbose) const
   {
-    std::vector<byte> temp(this->Nstate_, 0);
+    byte temp[16] = {0};
     const uint8_t fixed[] = {2, 3, 1, 1, 1, 2, 3, 1, 1, 1, 2, 3, 3, 1, 1, 2};
 
     for (uint8_t i = 0; i < this->Bsize_; i++)
@@ -250,7 +440,7 @@ namespace ns3
     }
   }
 
-  void AES::_decryption(std::vector<byte> &state, const std::vector<byte> &roundKey, bool verbose)
+  void AES::_decryption(byte *state, const byte *roundKey, bool verbose) const
   {
     this->_addRoundKey(state, roundKey, this->Nround_, verbose);
     for (uint8_t i = this->Nround_ - 1; i > 0; i--)
@@ -265,12 +455,28 @@ namespace ns3
     this->_addRoundKey(state, roundKey, 0, verbose);
   }
 
-  byte AES::_mappingInvSBox(const byte val)
+  // same order of steps as _encryption, on the decryption round keys of AESKey
+  void AES::_eqDecryption(byte *state, const byte *invRoundKey, bool verbose) const
+  {
+    this->_addRoundKey(state, invRoundKey, 0, verbose);
+    for (uint8_t i = 1; i < this->Nround_; i++)
+    {
+      this->_invSubBytes(state, verbose);
+      this->_invShiftRows(state, verbose);
+      this->_invMixColumns(state, verbose);
+      this->_addRoundKey(state, invRoundKey, i, verbose);
+    }
+    this->_invSubBytes(state, verbose);
+    this->_invShiftRows(state, verbose);
+    this->_addRoundKey(state, invRoundKey, this->Nround_, verbose);
+  }
+
+  byte AES::_mappingInvSBox(const byte val) const
   {
     return this->inv_sbox_[val];
   }
 
-  void AES::_invSubBytes(std::vector<byte> &state, bool verbose)
+  void AES::_invSubBytes(byte *state, bool verbose) const
   {
     for (uint8_t i = 0; i < this->Nstate_; i++)
     {
@@ -284,7 +490,7 @@ namespace ns3
     }
   }
 
-  void AES::_invShiftRows(std::vector<byte> &state, bool verbose)
+  void AES::_invShiftRows(byte *state, bool verbose) const
   {
     byte temp;
     // Rotate row 1
@@ -317,38 +523,11 @@ namespace ns3
     }
   }
 
-  void AES::_invMixColumns(std::vector<byte> &state, bool verbose)
+  void AES::_invMixColumns(byte *state, bool verbose) const
   {
-    std::vector<byte> temp(this->Nstate_, 0);
-    const uint8_t fixed[] = {14, 11, 13, 9, 9, 14, 11, 13, 13, 9, 14, 11, 11, 13, 9, 14};
-
-    for (uint8_t i = 0; i < this->Bsize_; i++)
-    {
-      for (uint8_t j = 0; j < this->Ncol_; j++)
-      {
-        for (uint8_t k = j * 4; k < (j * 4) + 4; k++)
-        {
-          temp[(i * this->Ncol_) + j] ^= multiply(multiply(multiply(state[(i * this->Ncol_) + (k % 4)])));
-
-          if (fixed[k] == 9 || fixed[k] == 11 || fixed[k] == 13)
-          {
-            temp[(i * this->Ncol_) + j] ^= state[(i * this->Ncol_) + (k % 4)];
-          }
-          if (fixed[k] == 11 || fixed[k] == 14)
-          {
-            temp[(i * this->Ncol_) + j] ^= multiply(state[(i * this->Ncol_) + (k % 4)]);
-          }
-          if (fixed[k] == 13 || fixed[k] == 14)
-          {
-            temp[(i * this->Ncol_) + j] ^= multiply(multiply(state[(i * this->Ncol_) + (k % 4)]));
-          }
-        }
-      }
-    }
-
-    for (uint8_t i = 0; i < this->Nstate_; i++)
+    for (uint8_t i = 0; i < this->Ncol_; i++)
     {
-      state[i] = temp[i];
+      invMixColumn(state + i * this->Ncol_);
     }
 
     if (verbose)
@@ -358,196 +537,1131 @@ namespace ns3
     }
   }
 
-  std::string AES::_convertTypeByteStateToStr(const std::vector<byte> &state, bool decryption)
+  void AES::_encryptBlock(byte *state, const AESKey &key, bool verbose) const
   {
-    std::string ret = "";
-
-    char buf[3];
-    for (uint32_t i = 0; i < this->Nstate_; i++)
+    if (verbose || this->engine_ == ENGINE::PORTABLE)
     {
-      snprintf(buf, sizeof(buf), "%02X", state[i]);
-
-      if (decryption)
-      { // check padding value
-        if ((this->Nstate_ - i) == state[i])
-        {
-          byte padding = state[i];
-          uint32_t j;
-          for (j = i + 1; j < this->Nstate_; j++)
-          {
-            if (state[j] != padding)
-              break;
-          }
-          if (j == this->Nstate_) // if all remained bytes are same with padding, stop converting
-            return ret;
-        }
-      }
-
-      ret += buf;
+      this->_encryption(state, key.getRoundKey(), verbose);
+    }
+    else
+    {
+      this->_encryptTTable(state, key.getRoundKey());
     }
+  }
 
-    return ret;
+  void AES::_decryptBlock(byte *state, const AESKey &key, bool verbose) const
+  {
+    if (verbose)
+    {
+      this->_decryption(state, key.getRoundKey(), verbose); // textbook order, the steps match FIPS-197 figure 12
+    }
+    else if (this->engine_ == ENGINE::PORTABLE)
+    {
+      this->_eqDecryption(state, key.getInvRoundKey(), verbose);
+    }
+    else
+    {
+      this->_decryptTTable(state, key.getInvRoundKey());
+    }
   }
 
-  std::vector<byte> AES::_convertTypeStrToByteBlock(std::string str)
+  size_t AES::_ctrCrypt(const byte *counter0, const byte *input, size_t length, byte *output, const AESKey &key, bool verbose) const
   {
-    uint32_t len = str.length();
-    std::vector<byte> block(len / 2, 0);
+    byte counter[16];
+    byte keystream[8 * 16]; // 8 counter blocks per engine call, so AES-NI / bitslice can interleave them
+    std::copy(counter0, counter0 + this->Nstate_, counter);
 
-    // to upper
-    std::transform(str.begin(), str.end(), str.begin(), ::toupper);
+    if (verbose)
+    {
+      this->_printRoundKey(key);
+    }
 
-    byte tmp = 0;
-    for (uint32_t i = 0; i < len; i++)
+    for (size_t i = 0; i < length; i += sizeof(keystream))
     {
-      if (str[i] >= '0' && str[i] <= '9')
-      {
-        tmp = 16 * tmp + (str[i] - '0');
-      }
-      else if (str[i] >= 'A' && str[i] <= 'F')
-      {
-        tmp = 16 * tmp + (str[i] - 'A' + 10);
-      }
-      else
+      size_t n = std::min(length - i, sizeof(keystream));
+      size_t blocks = (n + this->Nstate_ - 1) / this->Nstate_;
+      for (size_t b = 0; b < blocks; b++)
       {
-        return std::vector<byte>();
+        std::copy(counter, counter + this->Nstate_, keystream + b * this->Nstate_);
+        this->_incrementCounter(counter);
       }
 
-      if (i % 2 == 1)
+      this->_encryptKeystream(keystream, blocks, key, verbose);
+
+      for (size_t j = 0; j < n; j++)
       {
-        block[i / 2] = tmp;
-        tmp = 0;
+        output[i + j] = input[i + j] ^ keystream[j];
       }
     }
 
-    return block;
+    return length;
   }
 
-  void AES::_printState(const std::vector<byte> &state)
+  void AES::_encryptKeystream(byte *blocks, size_t count, const AESKey &key, bool verbose) const
   {
-    for (uint8_t r = 0; r < this->Bsize_; r++)
+    if (!verbose && this->engine_ == ENGINE::AESNI)
     {
-      printf("      ");
-      for (uint8_t c = 0; c < this->Ncol_; c++)
+      this->_ecbEncryptNI(blocks, blocks, count, key.getRoundKey());
+    }
+    else if (!verbose && this->engine_ == ENGINE::BITSLICE)
+    {
+      this->_ecbEncryptBS(blocks, blocks, count, key.getRoundKey());
+    }
+    else
+    {
+      for (size_t b = 0; b < count; b++)
       {
-        printf("%02X ", state[(c * this->Ncol_) + r]);
+        this->_encryptBlock(blocks + b * this->Nstate_, key, verbose);
       }
-      printf("\n");
     }
   }
 
-  void AES::setIV(uint32_t seed)
+  void AES::_incrementCounter(byte *counter) const
   {
-    assert(this->mode_ == MODE::CBC);
-    srand(seed);
-
-    for (uint8_t i = 0; i < this->Nstate_; i++)
-      this->iv_[i] = rand() % 256;
+    // 128 bits big endian counter
+    for (int8_t i = this->Nstate_ - 1; i >= 0; i--)
+    {
+      if (++counter[i] != 0)
+        break;
+    }
   }
 
-  void AES::setIV(std::vector<byte> iv)
+  void AES::_ghashInit(GHashKey &gkey, const AESKey &key) const
   {
-    assert(this->mode_ == MODE::CBC);
-    assert(iv.size() == 16);
-
-    for (uint8_t i = 0; i < this->Nstate_; i++)
-      this->iv_[i] = iv[i];
+    std::fill(gkey.h, gkey.h + this->Nstate_, 0);
+    this->_encryptKeystream(gkey.h, 1, key, false);
+    gkey.clmul = AES::_hasCLMUL();
+    if (gkey.clmul)
+      return;
+
+    // Shoup's 4-bit table : hh/hl[i] = H * i, bits are reflected as in the GCM specification
+    uint64_t vh = 0, vl = 0;
+    for (uint8_t i = 0; i < 8; i++)
+    {
+      vh = (vh << 8) | gkey.h[i];
+      vl = (vl << 8) | gkey.h[i + 8];
+    }
+    gkey.hh[0] = gkey.hl[0] = 0;
+    gkey.hh[8] = vh;
+    gkey.hl[8] = vl;
+    for (uint8_t i = 4; i > 0; i >>= 1)
+    {
+      uint64_t t = (vl & 1) * 0xe100000000000000ULL;
+      vl = (vh << 63) | (vl >> 1);
+      vh = (vh >> 1) ^ t;
+      gkey.hh[i] = vh;
+      gkey.hl[i] = vl;
+    }
+    for (uint8_t i = 2; i <= 8; i *= 2)
+    {
+      for (uint8_t j = 1; j < i; j++)
+      {
+        gkey.hh[i + j] = gkey.hh[i] ^ gkey.hh[j];
+        gkey.hl[i + j] = gkey.hl[i] ^ gkey.hl[j];
+      }
+    }
   }
 
-  std::vector<byte> AES::getIV() const
+  void AES::_ghashMultiply(byte *x, const GHashKey &gkey) const
   {
-    return this->iv_;
-  }
+    // reduction of the 4 bits shifted out, x^128 = x^7 + x^2 + x + 1
+    static const uint64_t last4[16] = {
+        0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+        0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0};
 
-  std::string AES::encryption(const std::string &input, const std::string &cipherKey, bool verbose)
-  {
-    assert(cipherKey.size() == this->Nkey_ * 4 * 2); // check cipherKey(str) size == 128 / 192 / 256 bits * 2
+    uint8_t lo = x[15] & 0xf;
+    uint64_t zh = gkey.hh[lo];
+    uint64_t zl = gkey.hl[lo];
 
-    uint32_t block_size = input.length() / (this->Nstate_ * 2);
-    if (input.length() % (this->Nstate_ * 2) != 0)
-      block_size += 1;
+    for (int8_t i = 15; i >= 0; i--)
+    {
+      lo = x[i] & 0xf;
+      uint8_t hi = (x[i] >> 4) & 0xf;
+      uint8_t rem;
 
-    std::string cipherText = "";
-    std::vector<byte> plainText = this->_convertTypeStrToByteBlock(input);
-    std::vector<byte> _cipherKey = this->_convertTypeStrToByteBlock(cipherKey);
-    std::vector<byte> roundKey = this->_expandKey(_cipherKey, verbose);
+      if (i != 15)
+      {
+        rem = zl & 0xf;
+        zl = (zh << 60) | (zl >> 4);
+        zh = (zh >> 4) ^ (last4[rem] << 48) ^ gkey.hh[lo];
+        zl ^= gkey.hl[lo];
+      }
 
-    if (this->mode_ == MODE::CBC)
-    {
-      this->phiv_ = this->iv_;
+      rem = zl & 0xf;
+      zl = (zh << 60) | (zl >> 4);
+      zh = (zh >> 4) ^ (last4[rem] << 48) ^ gkey.hh[hi];
+      zl ^= gkey.hl[hi];
     }
 
-    for (uint32_t i = 0; i < block_size; i++)
+    for (uint8_t i = 0; i < 8; i++)
     {
-      std::vector<byte> state = this->_createState(plainText, i * this->Nstate_);
+      x[i] = byte(zh >> (56 - 8 * i));
+      x[i + 8] = byte(zl >> (56 - 8 * i));
+    }
+  }
 
-      if (this->mode_ == MODE::CBC)
+  void AES::_ghashUpdate(byte *x, const byte *data, size_t length, const GHashKey &gkey) const
+  {
+    size_t full = length / this->Nstate_;
+    if (gkey.clmul)
+    {
+      this->_ghashCLMUL(x, gkey.h, data, full);
+    }
+    else
+    {
+      for (size_t i = 0; i < full; i++)
       {
-        this->_xor_iv(state, this->phiv_, verbose);
+        for (uint8_t j = 0; j < this->Nstate_; j++)
+          x[j] ^= data[i * this->Nstate_ + j];
+        this->_ghashMultiply(x, gkey);
       }
+    }
 
-      this->_encryption(state, roundKey, verbose);
-
-      if (this->mode_ == MODE::CBC)
+    // the last partial block is padded with zeros
+    size_t rest = length - full * this->Nstate_;
+    if (rest)
+    {
+      byte block[16] = {0};
+      std::copy(data + full * this->Nstate_, data + length, block);
+      if (gkey.clmul)
       {
-        this->phiv_ = state;
+        this->_ghashCLMUL(x, gkey.h, block, 1);
+      }
+      else
+      {
+        for (uint8_t j = 0; j < this->Nstate_; j++)
+          x[j] ^= block[j];
+        this->_ghashMultiply(x, gkey);
       }
-
-      cipherText += this->_convertTypeByteStateToStr(state, false);
     }
+  }
 
-    if (verbose)
+  void AES::_gcmHash(const byte *aad, size_t aadLength, const byte *cipherText, size_t length, byte *x, const GHashKey &gkey) const
+  {
+    // S = GHASH(A || C || len(A) || len(C))
+    std::fill(x, x + this->Nstate_, 0);
+    this->_ghashUpdate(x, aad, aadLength, gkey);
+    this->_ghashUpdate(x, cipherText, length, gkey);
+
+    byte lengths[16];
+    uint64_t aadBits = uint64_t(aadLength) * 8, textBits = uint64_t(length) * 8;
+    for (uint8_t i = 0; i < 8; i++)
     {
-      std::cout << "\n --- Cipher Text --- \n";
-      uint32_t i = 0;
-      for (auto &c : cipherText)
-      {
-        std::cout << c;
-        i++;
-        if (i % (this->Nstate_ * 2) == 0)
-          std::cout << "\n";
-      }
-      std::cout << "\n";
+      lengths[i] = byte(aadBits >> (56 - 8 * i));
+      lengths[i + 8] = byte(textBits >> (56 - 8 * i));
     }
+    this->_ghashUpdate(x, lengths, sizeof(lengths), gkey);
+  }
 
-    return cipherText;
+  void AES::_gcmTag(const byte *j0, const byte *aad, size_t aadLength, const byte *cipherText, size_t length, byte *tag, const AESKey &key) const
+  {
+    GHashKey gkey;
+    this->_ghashInit(gkey, key);
+
+    // T = E(K, J0) ^ S
+    byte x[16];
+    this->_gcmHash(aad, aadLength, cipherText, length, x, gkey);
+
+    byte ekj0[16];
+    std::copy(j0, j0 + this->Nstate_, ekj0);
+    this->_encryptKeystream(ekj0, 1, key, false);
+    for (uint8_t i = 0; i < this->Nstate_; i++)
+      tag[i] = ekj0[i] ^ x[i];
   }
 
-  std::string AES::decryption(const std::string &input, const std::string &cipherKey, bool verbose)
+  void AES::encryptAndTag(const byte *iv, const byte *aad, size_t aadLength, const byte *input, size_t length,
+                          byte *output, byte *tag, const AESKey &key) const
   {
-    assert(cipherKey.size() == this->Nkey_ * 4 * 2); // check cipherKey(str) size == 128 / 192 / 256 bits * 2
+    assert(this->mode_ == MODE::GCM);
+    assert(key.getKeyBits() == this->Nkey_ * 32u);
+
+    // J0 = IV || 0^31 || 1, the payload is encrypted from inc32(J0)
+    byte j0[16] = {0};
+    std::copy(iv, iv + 12, j0);
+    j0[15] = 1;
+    byte counter[16];
+    std::copy(j0, j0 + this->Nstate_, counter);
+    counter[15] = 2;
+
+    this->_ctrCrypt(counter, input, length, output, key, false);
+    this->_gcmTag(j0, aad, aadLength, output, length, tag, key);
+  }
 
-    uint32_t block_size = input.length() / (this->Nstate_ * 2);
+  bool AES::decryptAndVerify(const byte *iv, const byte *aad, size_t aadLength, const byte *input, size_t length,
+                             byte *output, const byte *tag, const AESKey &key) const
+  {
+    assert(this->mode_ == MODE::GCM);
+    assert(key.getKeyBits() == this->Nkey_ * 32u);
 
-    std::string plainText = "";
-    std::vector<byte> cipherText = this->_convertTypeStrToByteBlock(input);
-    std::vector<byte> _cipherKey = this->_convertTypeStrToByteBlock(cipherKey);
-    std::vector<byte> roundKey = this->_expandKey(_cipherKey, verbose);
+    byte j0[16] = {0};
+    std::copy(iv, iv + 12, j0);
+    j0[15] = 1;
 
-    if (this->mode_ == MODE::CBC)
-    {
-      this->phiv_ = this->iv_;
-    }
+    byte expected[16];
+    this->_gcmTag(j0, aad, aadLength, input, length, expected, key);
+
+    // constant-time comparison
+    byte diff = 0;
+    for (uint8_t i = 0; i < this->Nstate_; i++)
+      diff |= expected[i] ^ tag[i];
+    if (diff != 0)
+      return false;
+
+    byte counter[16];
+    std::copy(j0, j0 + this->Nstate_, counter);
+    counter[15] = 2;
+    this->_ctrCrypt(counter, input, length, output, key, false);
+    return true;
+  }
 
-    for (uint32_t i = 0; i < block_size; i++)
+  void AES::_ctrBatch(AESMessage *messages, size_t count, const byte *counters, const AESKey &key) const
+  {
+    byte keystream[8 * 16];
+    const byte *source[8];
+    byte *destination[8];
+    size_t bytes[8];
+    size_t fill = 0;
+
+    auto flush = [&]() {
+      this->_encryptKeystream(keystream, fill, key, false);
+      for (size_t b = 0; b < fill; b++)
+        for (size_t j = 0; j < bytes[b]; j++)
+          destination[b][j] = source[b][j] ^ keystream[b * this->Nstate_ + j];
+      fill = 0;
+    };
+
+    for (size_t m = 0; m < count; m++)
     {
-      std::vector<byte> state = this->_createState(cipherText, i * this->Nstate_);
-      std::vector<byte> tmp;
+      const AESMessage &message = messages[m];
+      if (!message.ok)
+        continue;
 
-      if (this->mode_ == MODE::CBC)
+      byte counter[16];
+      std::copy(counters + m * this->Nstate_, counters + (m + 1) * this->Nstate_, counter);
+      for (size_t i = 0; i < message.length; i += this->Nstate_)
       {
-        tmp = state;
+        std::copy(counter, counter + this->Nstate_, keystream + fill * this->Nstate_);
+        this->_incrementCounter(counter);
+        source[fill] = message.input + i;
+        destination[fill] = message.output + i;
+        bytes[fill] = std::min<size_t>(this->Nstate_, message.length - i);
+        if (++fill == 8)
+          flush();
       }
+    }
+    if (fill != 0)
+      flush();
+  }
 
-      this->_decryption(state, roundKey, verbose);
-
-      if (this->mode_ == MODE::CBC)
-      {
-        this->_xor_iv(state, this->phiv_, verbose);
-        this->phiv_ = tmp;
+  void AES::_decryptBlocks(byte *blocks, size_t count, const AESKey &key) const
+  {
+    if (this->engine_ == ENGINE::AESNI)
+    {
+      this->_ecbDecryptNI(blocks, blocks, count, key.getInvRoundKey());
+    }
+    else if (this->engine_ == ENGINE::BITSLICE)
+    {
+      this->_ecbDecryptBS(blocks, blocks, count, key.getRoundKey());
+    }
+    else
+    {
+      for (size_t b = 0; b < count; b++)
+      {
+        this->_decryptBlock(blocks + b * this->Nstate_, key, false);
+      }
+    }
+  }
+
+  // block ^= chain, 64 bits at a time (the byte loops of _xor_iv are too slow between two engine calls)
+  static void
+  xorBlock(byte *block, const byte *chain)
+  {
+    uint64_t a[2], b[2];
+    std::memcpy(a, block, 16);
+    std::memcpy(b, chain, 16);
+    a[0] ^= b[0];
+    a[1] ^= b[1];
+    std::memcpy(block, a, 16);
+  }
+
+  void AES::_blockBatch(AESMessage *messages, size_t count, const AESKey &key, bool encrypt) const
+  {
+    byte blocks[8 * 16];
+    byte chains[8 * 16]; // CBC decryption : the cipher block in front of every lane
+    byte *destination[8];
+    size_t fill = 0;
+    bool cbc = this->mode_ == MODE::CBC;
+
+    auto flush = [&]() {
+      if (encrypt)
+        this->_encryptKeystream(blocks, fill, key, false);
+      else
+        this->_decryptBlocks(blocks, fill, key);
+      for (size_t b = 0; b < fill; b++)
+      {
+        if (cbc)
+          xorBlock(blocks + b * 16, chains + b * 16);
+        std::memcpy(destination[b], blocks + b * 16, 16);
+      }
+      fill = 0;
+    };
+
+    for (size_t m = 0; m < count; m++)
+    {
+      AESMessage &message = messages[m];
+      // encryption pads the last block, decryption drops an incomplete one (same as _encryptBytes / _decryptBytes)
+      message.outLength = encrypt ? this->getPaddedLength(message.length) : message.length / 16 * 16;
+      message.ok = true;
+
+      // runs of 8 whole blocks fill the lanes on their own and go to the engine where they are
+      size_t direct = message.length / 128 * 128;
+      byte previous[16] = {0}; // the cipher block in front of the next one, copied before output overwrites it
+      if (cbc)
+        std::memcpy(previous, direct ? message.input + direct - 16 : message.iv, 16);
+      if (direct && encrypt)
+        this->_encryptBytes(message.iv, message.input, direct, message.output, key, false);
+      else if (direct)
+        this->_decryptBytes(message.iv, message.input, direct, message.output, key, false);
+
+      // the rest shares the lanes with the other messages
+      for (size_t i = direct; i < message.outLength; i += 16)
+      {
+        if (message.length - i < 16)
+          this->_createState(blocks + fill * 16, message.input + i, message.length - i);
+        else
+          std::memcpy(blocks + fill * 16, message.input + i, 16);
+        if (cbc)
+        {
+          std::memcpy(chains + fill * 16, previous, 16);
+          std::memcpy(previous, message.input + i, 16);
+        }
+        destination[fill] = message.output + i;
+        if (++fill == 8)
+          flush();
+      }
+    }
+    if (fill != 0)
+      flush();
+  }
+
+  void AES::_cbcEncryptBatch(AESMessage *messages, size_t count, const AESKey &key) const
+  {
+    byte blocks[8 * 16];
+    byte chains[8 * 16]; // last cipher block of every lane
+    size_t lane[8];      // message in the lane
+    size_t offset[8];    // its next block
+    size_t lanes = 0;
+    size_t next = 0;
+
+    for (;;)
+    {
+      // free lanes take the next messages
+      while (lanes < 8 && next < count)
+      {
+        AESMessage &message = messages[next];
+        message.outLength = this->getPaddedLength(message.length);
+        message.ok = true;
+        if (message.outLength != 0)
+        {
+          lane[lanes] = next;
+          offset[lanes] = 0;
+          std::memcpy(chains + lanes * 16, message.iv, 16);
+          lanes++;
+        }
+        next++;
+      }
+      if (lanes == 0)
+        break;
+
+      // one block of every lane per engine call
+      for (size_t l = 0; l < lanes; l++)
+      {
+        const AESMessage &message = messages[lane[l]];
+        byte *block = blocks + l * 16;
+        if (message.length - offset[l] < 16)
+          this->_createState(block, message.input + offset[l], message.length - offset[l]);
+        else
+          std::memcpy(block, message.input + offset[l], 16);
+        xorBlock(block, chains + l * 16);
+      }
+      this->_encryptKeystream(blocks, lanes, key, false);
+
+      for (size_t l = lanes; l-- > 0;)
+      {
+        AESMessage &message = messages[lane[l]];
+        std::memcpy(message.output + offset[l], blocks + l * 16, 16);
+        std::memcpy(chains + l * 16, blocks + l * 16, 16);
+        offset[l] += 16;
+        if (offset[l] < message.outLength)
+          continue;
+
+        // done : the last lane moves into its place
+        lanes--;
+        lane[l] = lane[lanes];
+        offset[l] = offset[lanes];
+        std::memcpy(chains + l * 16, chains + lanes * 16, 16);
+      }
+    }
+  }
+
+  void AES::encryptBatch(AESMessage *messages, size_t count, const AESKey &key) const
+  {
+    assert(key.getKeyBits() == this->Nkey_ * 32u);
+
+    if (this->mode_ == MODE::ECB || this->mode_ == MODE::CBC)
+    {
+      if (this->mode_ == MODE::CBC)
+        this->_cbcEncryptBatch(messages, count, key);
+      else
+        this->_blockBatch(messages, count, key, true);
+      return;
+    }
+
+    // CTR / GCM in groups whose counter blocks fit on the stack, GHASH keyed once for all of them
+    GHashKey gkey;
+    if (this->mode_ == MODE::GCM)
+      this->_ghashInit(gkey, key);
+    for (size_t first = 0; first < count; first += CTR_GROUP)
+      this->_ctrEncryptGroup(messages + first, std::min(count - first, CTR_GROUP), key, gkey);
+  }
+
+  void AES::decryptBatch(AESMessage *messages, size_t count, const AESKey &key) const
+  {
+    assert(key.getKeyBits() == this->Nkey_ * 32u);
+
+    if (this->mode_ == MODE::ECB || this->mode_ == MODE::CBC)
+    {
+      this->_blockBatch(messages, count, key, false);
+      return;
+    }
+
+    GHashKey gkey;
+    if (this->mode_ == MODE::GCM)
+      this->_ghashInit(gkey, key);
+    for (size_t first = 0; first < count; first += CTR_GROUP)
+      this->_ctrDecryptGroup(messages + first, std::min(count - first, CTR_GROUP), key, gkey);
+  }
+
+  void AES::_ctrEncryptGroup(AESMessage *messages, size_t count, const AESKey &key, const GHashKey &gkey) const
+  {
+    // first counter block of every message : the iv in CTR, inc32(J0) = IV || 2 in GCM
+    byte counters[CTR_GROUP * 16] = {0};
+    for (size_t m = 0; m < count; m++)
+    {
+      byte *counter = counters + m * this->Nstate_;
+      if (this->mode_ == MODE::CTR)
+      {
+        std::copy(messages[m].iv, messages[m].iv + this->Nstate_, counter);
+      }
+      else
+      {
+        std::copy(messages[m].iv, messages[m].iv + 12, counter);
+        counter[15] = 2;
+      }
+      messages[m].outLength = messages[m].length;
+      messages[m].ok = true;
+    }
+    this->_ctrBatch(messages, count, counters, key);
+
+    if (this->mode_ == MODE::GCM)
+    {
+      // E(K, J0) of all messages in one engine call, J0 = inc32(J0) - 1
+      for (size_t m = 0; m < count; m++)
+        counters[m * this->Nstate_ + 15] = 1;
+      this->_encryptKeystream(counters, count, key, false);
+
+      for (size_t m = 0; m < count; m++)
+      {
+        AESMessage &message = messages[m];
+        byte x[16];
+        this->_gcmHash(message.aad, message.aadLength, message.output, message.length, x, gkey);
+        for (uint8_t i = 0; i < this->Nstate_; i++)
+          message.tag[i] = counters[m * this->Nstate_ + i] ^ x[i];
+      }
+    }
+  }
+
+  void AES::_ctrDecryptGroup(AESMessage *messages, size_t count, const AESKey &key, const GHashKey &gkey) const
+  {
+    byte counters[CTR_GROUP * 16] = {0};
+    for (size_t m = 0; m < count; m++)
+    {
+      byte *counter = counters + m * this->Nstate_;
+      if (this->mode_ == MODE::CTR)
+      {
+        std::copy(messages[m].iv, messages[m].iv + this->Nstate_, counter);
+      }
+      else
+      {
+        std::copy(messages[m].iv, messages[m].iv + 12, counter);
+        counter[15] = 1;
+      }
+      messages[m].ok = true;
+    }
+
+    if (this->mode_ == MODE::GCM)
+    {
+      // verify every tag before decrypting anything
+      byte ekj0[CTR_GROUP * 16];
+      std::memcpy(ekj0, counters, count * 16);
+      this->_encryptKeystream(ekj0, count, key, false);
+
+      for (size_t m = 0; m < count; m++)
+      {
+        AESMessage &message = messages[m];
+        byte x[16];
+        this->_gcmHash(message.aad, message.aadLength, message.input, message.length, x, gkey);
+
+        // constant-time comparison
+        byte diff = 0;
+        for (uint8_t i = 0; i < this->Nstate_; i++)
+          diff |= ekj0[m * this->Nstate_ + i] ^ x[i] ^ message.tag[i];
+        message.ok = diff == 0;
+        counters[m * this->Nstate_ + 15] = 2;
+      }
+    }
+
+    this->_ctrBatch(messages, count, counters, key);
+    for (size_t m = 0; m < count; m++)
+      messages[m].outLength = messages[m].ok ? messages[m].length : 0;
+  }
+
+  void AES::_bulkEncrypt(const byte *input, byte *output, size_t blocks, const AESKey &key, byte *chain) const
+  {
+    if (this->engine_ == ENGINE::AESNI)
+    {
+      if (this->mode_ == MODE::CBC)
+        this->_cbcEncryptNI(input, output, blocks, key.getRoundKey(), chain);
+      else
+        this->_ecbEncryptNI(input, output, blocks, key.getRoundKey());
+    }
+    else
+    {
+      if (this->mode_ == MODE::CBC)
+        this->_cbcEncryptBS(input, output, blocks, key.getRoundKey(), chain);
+      else
+        this->_ecbEncryptBS(input, output, blocks, key.getRoundKey());
+    }
+  }
+
+  void AES::_bulkDecrypt(const byte *input, byte *output, size_t blocks, const AESKey &key, byte *chain) const
+  {
+    if (this->engine_ == ENGINE::AESNI)
+    {
+      if (this->mode_ == MODE::CBC)
+        this->_cbcDecryptNI(input, output, blocks, key.getInvRoundKey(), chain);
+      else
+        this->_ecbDecryptNI(input, output, blocks, key.getInvRoundKey());
+    }
+    else
+    {
+      if (this->mode_ == MODE::CBC)
+        this->_cbcDecryptBS(input, output, blocks, key.getRoundKey(), chain);
+      else
+        this->_ecbDecryptBS(input, output, blocks, key.getRoundKey());
+    }
+  }
+
+  void AES::_encryptTTable(byte *state, const byte *roundKey) const
+  {
+    const uint32_t(*Te)[256] = g_tables.Te;
+    const byte *rk = roundKey;
+    uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+
+    s0 = GETU32(state) ^ GETU32(rk);
+    s1 = GETU32((state + 4)) ^ GETU32((rk + 4));
+    s2 = GETU32((state + 8)) ^ GETU32((rk + 8));
+    s3 = GETU32((state + 12)) ^ GETU32((rk + 12));
+
+    for (uint8_t round = 1; round < this->Nround_; round++)
+    {
+      rk += this->Nstate_;
+      t0 = Te[0][s0 >> 24] ^ Te[1][(s1 >> 16) & 0xff] ^ Te[2][(s2 >> 8) & 0xff] ^ Te[3][s3 & 0xff] ^ GETU32(rk);
+      t1 = Te[0][s1 >> 24] ^ Te[1][(s2 >> 16) & 0xff] ^ Te[2][(s3 >> 8) & 0xff] ^ Te[3][s0 & 0xff] ^ GETU32((rk + 4));
+      t2 = Te[0][s2 >> 24] ^ Te[1][(s3 >> 16) & 0xff] ^ Te[2][(s0 >> 8) & 0xff] ^ Te[3][s1 & 0xff] ^ GETU32((rk + 8));
+      t3 = Te[0][s3 >> 24] ^ Te[1][(s0 >> 16) & 0xff] ^ Te[2][(s1 >> 8) & 0xff] ^ Te[3][s2 & 0xff] ^ GETU32((rk + 12));
+      s0 = t0;
+      s1 = t1;
+      s2 = t2;
+      s3 = t3;
+    }
+
+    // last round : SubBytes and ShiftRows only
+    rk += this->Nstate_;
+    t0 = (uint32_t(sbox_[s0 >> 24]) << 24) ^ (uint32_t(sbox_[(s1 >> 16) & 0xff]) << 16) ^ (uint32_t(sbox_[(s2 >> 8) & 0xff]) << 8) ^ uint32_t(sbox_[s3 & 0xff]) ^ GETU32(rk);
+    t1 = (uint32_t(sbox_[s1 >> 24]) << 24) ^ (uint32_t(sbox_[(s2 >> 16) & 0xff]) << 16) ^ (uint32_t(sbox_[(s3 >> 8) & 0xff]) << 8) ^ uint32_t(sbox_[s0 & 0xff]) ^ GETU32((rk + 4));
+    t2 = (uint32_t(sbox_[s2 >> 24]) << 24) ^ (uint32_t(sbox_[(s3 >> 16) & 0xff]) << 16) ^ (uint32_t(sbox_[(s0 >> 8) & 0xff]) << 8) ^ uint32_t(sbox_[s1 & 0xff]) ^ GETU32((rk + 8));
+    t3 = (uint32_t(sbox_[s3 >> 24]) << 24) ^ (uint32_t(sbox_[(s0 >> 16) & 0xff]) << 16) ^ (uint32_t(sbox_[(s1 >> 8) & 0xff]) << 8) ^ uint32_t(sbox_[s2 & 0xff]) ^ GETU32((rk + 12));
+
+    PUTU32(state, t0);
+    PUTU32((state + 4), t1);
+    PUTU32((state + 8), t2);
+    PUTU32((state + 12), t3);
+  }
+
+  void AES::_decryptTTable(byte *state, const byte *invRoundKey) const
+  {
+    const uint32_t(*Td)[256] = g_tables.Td;
+    const byte *rk = invRoundKey;
+    uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+
+    s0 = GETU32(state) ^ GETU32(rk);
+    s1 = GETU32((state + 4)) ^ GETU32((rk + 4));
+    s2 = GETU32((state + 8)) ^ GETU32((rk + 8));
+    s3 = GETU32((state + 12)) ^ GETU32((rk + 12));
+
+    for (uint8_t round = 1; round < this->Nround_; round++)
+    {
+      rk += this->Nstate_;
+      t0 = Td[0][s0 >> 24] ^ Td[1][(s3 >> 16) & 0xff] ^ Td[2][(s2 >> 8) & 0xff] ^ Td[3][s1 & 0xff] ^ GETU32(rk);
+      t1 = Td[0][s1 >> 24] ^ Td[1][(s0 >> 16) & 0xff] ^ Td[2][(s3 >> 8) & 0xff] ^ Td[3][s2 & 0xff] ^ GETU32((rk + 4));
+      t2 = Td[0][s2 >> 24] ^ Td[1][(s1 >> 16) & 0xff] ^ Td[2][(s0 >> 8) & 0xff] ^ Td[3][s3 & 0xff] ^ GETU32((rk + 8));
+      t3 = Td[0][s3 >> 24] ^ Td[1][(s2 >> 16) & 0xff] ^ Td[2][(s1 >> 8) & 0xff] ^ Td[3][s0 & 0xff] ^ GETU32((rk + 12));
+      s0 = t0;
+      s1 = t1;
+      s2 = t2;
+      s3 = t3;
+    }
+
+    // last round : InvShiftRows and InvSubBytes only
+    rk += this->Nstate_;
+    t0 = (uint32_t(inv_sbox_[s0 >> 24]) << 24) ^ (uint32_t(inv_sbox_[(s3 >> 16) & 0xff]) << 16) ^ (uint32_t(inv_sbox_[(s2 >> 8) & 0xff]) << 8) ^ uint32_t(inv_sbox_[s1 & 0xff]) ^ GETU32(rk);
+    t1 = (uint32_t(inv_sbox_[s1 >> 24]) << 24) ^ (uint32_t(inv_sbox_[(s0 >> 16) & 0xff]) << 16) ^ (uint32_t(inv_sbox_[(s3 >> 8) & 0xff]) << 8) ^ uint32_t(inv_sbox_[s2 & 0xff]) ^ GETU32((rk + 4));
+    t2 = (uint32_t(inv_sbox_[s2 >> 24]) << 24) ^ (uint32_t(inv_sbox_[(s1 >> 16) & 0xff]) << 16) ^ (uint32_t(inv_sbox_[(s0 >> 8) & 0xff]) << 8) ^ uint32_t(inv_sbox_[s3 & 0xff]) ^ GETU32((rk + 8));
+    t3 = (uint32_t(inv_sbox_[s3 >> 24]) << 24) ^ (uint32_t(inv_sbox_[(s2 >> 16) & 0xff]) << 16) ^ (uint32_t(inv_sbox_[(s1 >> 8) & 0xff]) << 8) ^ uint32_t(inv_sbox_[s0 & 0xff]) ^ GETU32((rk + 12));
+
+    PUTU32(state, t0);
+    PUTU32((state + 4), t1);
+    PUTU32((state + 8), t2);
+    PUTU32((state + 12), t3);
+  }
+
+  std::string AES::_convertTypeByteStateToStr(const byte *state, bool decryption) const
+  {
+    std::string ret = "";
+
+    char buf[3];
+    for (uint32_t i = 0; i < this->Nstate_; i++)
+    {
+      snprintf(buf, sizeof(buf), "%02X", state[i]);
+
+      if (decryption)
+      { // check padding value
+        if ((this->Nstate_ - i) == state[i])
+        {
+          byte padding = state[i];
+          uint32_t j;
+          for (j = i + 1; j < this->Nstate_; j++)
+          {
+            if (state[j] != padding)
+              break;
+          }
+          if (j == this->Nstate_) // if all remained bytes are same with padding, stop converting
+            return ret;
+        }
+      }
+
+      ret += buf;
+    }
+
+    return ret;
+  }
+
+  std::string AES::_convertTypeBytesToStr(const byte *bytes, size_t length) const
+  {
+    std::string ret = "";
+
+    char buf[3];
+    for (size_t i = 0; i < length; i++)
+    {
+      snprintf(buf, sizeof(buf), "%02X", bytes[i]);
+      ret += buf;
+    }
+
+    return ret;
+  }
+
+  std::vector<byte> AES::_convertTypeStrToByteBlock(std::string str)
+  {
+    uint32_t len = str.length();
+    std::vector<byte> block(len / 2, 0);
+
+    // to upper
+    std::transform(str.begin(), str.end(), str.begin(), ::toupper);
+
+    byte tmp = 0;
+    for (uint32_t i = 0; i < len; i++)
+    {
+      if (str[i] >= '0' && str[i] <= '9')
+      {
+        tmp = 16 * tmp + (str[i] - '0');
+      }
+      else if (str[i] >= 'A' && str[i] <= 'F')
+      {
+        tmp = 16 * tmp + (str[i] - 'A' + 10);
+      }
+      else
+      {
+        return std::vector<byte>();
       }
 
-      plainText += this->_convertTypeByteStateToStr(state, true);
+      if (i % 2 == 1)
+      {
+        block[i / 2] = tmp;
+        tmp = 0;
+      }
+    }
+
+    return block;
+  }
+
+  void AES::_printState(const byte *state) const
+  {
+    for (uint8_t r = 0; r < this->Bsize_; r++)
+    {
+      printf("      ");
+      for (uint8_t c = 0; c < this->Ncol_; c++)
+      {
+        printf("%02X ", state[(c * this->Ncol_) + r]);
+      }
+      printf("\n");
+    }
+  }
+
+  void AES::setIV(uint32_t seed)
+  {
+    assert(this->mode_ != MODE::ECB);
+    srand(seed);
+
+    for (uint8_t i = 0; i < this->Nstate_; i++)
+      this->iv_[i] = rand() % 256;
+  }
+
+  void AES::setIV(std::vector<byte> iv)
+  {
+    assert(this->mode_ != MODE::ECB);
+    assert(iv.size() == 16);
+
+    for (uint8_t i = 0; i < this->Nstate_; i++)
+      this->iv_[i] = iv[i];
+  }
+
+  std::vector<byte> AES::getIV() const
+  {
+    return this->iv_;
+  }
+
+  size_t AES::getPaddedLength(size_t length) const
+  {
+    if (this->mode_ == MODE::CTR || this->mode_ == MODE::GCM)
+      return length;
+    return ((length + this->Nstate_ - 1) / this->Nstate_) * this->Nstate_;
+  }
+
+  size_t AES::encryption(const byte *input, size_t length, byte *output, const byte *cipherKey, bool verbose) const
+  {
+    AESKey key(cipherKey, this->Nkey_ * 32);
+    return this->encryption(input, length, output, key, verbose);
+  }
+
+  size_t AES::encryption(const byte *input, size_t length, byte *output, const AESKey &key, bool verbose) const
+  {
+    return this->_encryptBytes(this->iv_.data(), input, length, output, key, verbose);
+  }
+
+  size_t AES::encryption(const byte *iv, const byte *input, size_t length, byte *output, const AESKey &key) const
+  {
+    return this->_encryptBytes(iv, input, length, output, key, false);
+  }
+
+  size_t AES::_encryptBytes(const byte *iv, const byte *input, size_t length, byte *output, const AESKey &key, bool verbose) const
+  {
+    assert(key.getKeyBits() == this->Nkey_ * 32u);
+    assert(this->mode_ != MODE::GCM); // GCM needs a tag, use encryptAndTag / decryptAndVerify
+
+    if (this->mode_ == MODE::CTR)
+    {
+      return this->_ctrCrypt(iv, input, length, output, key, verbose);
+    }
+
+    byte chain[16]; // previous cipher block (CBC)
+    byte state[16];
+
+    if (verbose)
+    {
+      this->_printRoundKey(key);
+    }
+
+    if (this->mode_ == MODE::CBC)
+    {
+      std::copy(iv, iv + this->Nstate_, chain);
+    }
+
+    size_t out_len = this->getPaddedLength(length);
+    if (!verbose && (this->engine_ == ENGINE::AESNI || this->engine_ == ENGINE::BITSLICE))
+    {
+      size_t full = length / this->Nstate_;
+      size_t tail = full * this->Nstate_;
+      this->_bulkEncrypt(input, output, full, key, chain);
+
+      if (tail != out_len)
+      {
+        this->_createState(state, input + tail, length - tail);
+        this->_bulkEncrypt(state, output + tail, 1, key, chain);
+      }
+      return out_len;
+    }
+
+    for (size_t i = 0; i < out_len; i += this->Nstate_)
+    {
+      this->_createState(state, input + i, length - i);
+
+      if (this->mode_ == MODE::CBC)
+      {
+        this->_xor_iv(state, chain, verbose);
+      }
+
+      this->_encryptBlock(state, key, verbose);
+
+      if (this->mode_ == MODE::CBC)
+      {
+        std::copy(state, state + this->Nstate_, chain);
+      }
+
+      std::copy(state, state + this->Nstate_, output + i);
+    }
+
+    return out_len;
+  }
+
+  size_t AES::decryption(const byte *input, size_t length, byte *output, const byte *cipherKey, bool verbose) const
+  {
+    AESKey key(cipherKey, this->Nkey_ * 32);
+    return this->decryption(input, length, output, key, verbose);
+  }
+
+  size_t AES::decryption(const byte *input, size_t length, byte *output, const AESKey &key, bool verbose) const
+  {
+    return this->_decryptBytes(this->iv_.data(), input, length, output, key, verbose);
+  }
+
+  size_t AES::decryption(const byte *iv, const byte *input, size_t length, byte *output, const AESKey &key) const
+  {
+    return this->_decryptBytes(iv, input, length, output, key, false);
+  }
+
+  size_t AES::_decryptBytes(const byte *iv, const byte *input, size_t length, byte *output, const AESKey &key, bool verbose) const
+  {
+    assert(key.getKeyBits() == this->Nkey_ * 32u);
+    assert(this->mode_ != MODE::GCM); // GCM needs a tag, use encryptAndTag / decryptAndVerify
+
+    if (this->mode_ == MODE::CTR)
+    {
+      return this->_ctrCrypt(iv, input, length, output, key, verbose);
+    }
+
+    byte chain[16]; // previous cipher block (CBC)
+    byte state[16];
+
+    if (verbose)
+    {
+      this->_printRoundKey(key);
+    }
+
+    if (this->mode_ == MODE::CBC)
+    {
+      std::copy(iv, iv + this->Nstate_, chain);
+    }
+
+    size_t out_len = (length / this->Nstate_) * this->Nstate_;
+    if (!verbose && (this->engine_ == ENGINE::AESNI || this->engine_ == ENGINE::BITSLICE))
+    {
+      this->_bulkDecrypt(input, output, out_len / this->Nstate_, key, chain);
+      return out_len;
+    }
+
+    for (size_t i = 0; i < out_len; i += this->Nstate_)
+    {
+      std::copy(input + i, input + i + this->Nstate_, state);
+
+      this->_decryptBlock(state, key, verbose);
+
+      if (this->mode_ == MODE::CBC)
+      {
+        this->_xor_iv(state, chain, verbose);
+        std::copy(input + i, input + i + this->Nstate_, chain); // input may be overwritten below (in-place)
+      }
+
+      std::copy(state, state + this->Nstate_, output + i);
+    }
+
+    return out_len;
+  }
+
+  // smallest slice worth handing to another thread
+  static const size_t g_bulkChunkBytes = 64 * 1024;
+
+  // counter + n as a 128-bit big endian number
+  static void
+  addCounter(byte *counter, uint64_t n)
+  {
+    for (int i = 15; i >= 0 && n != 0; i--)
+    {
+      n += counter[i];
+      counter[i] = byte(n);
+      n >>= 8;
+    }
+  }
+
+  size_t AES::bulkEncryption(VpnThreadPool &pool, const byte *iv, const byte *input, size_t length, byte *output,
+                             const AESKey &key) const
+  {
+    size_t units = (length + this->Nstate_ - 1) / this->Nstate_; // the last one may be a partial block
+    size_t chunks = std::min<size_t>(pool.GetThreads(), length / g_bulkChunkBytes);
+    if (this->mode_ == MODE::CBC || chunks < 2)
+    {
+      return this->_encryptBytes(iv, input, length, output, key, false);
+    }
+
+    pool.Run(chunks, [&](size_t chunk) {
+      size_t begin = units * chunk / chunks * this->Nstate_;
+      size_t end = std::min(units * (chunk + 1) / chunks * this->Nstate_, length);
+      byte counter[16];
+      if (this->mode_ == MODE::CTR)
+      {
+        std::copy(iv, iv + this->Nstate_, counter);
+        addCounter(counter, begin / this->Nstate_);
+      }
+      this->_encryptBytes(this->mode_ == MODE::CTR ? counter : iv, input + begin, end - begin, output + begin, key, false);
+    });
+    return this->getPaddedLength(length);
+  }
+
+  size_t AES::bulkDecryption(VpnThreadPool &pool, const byte *iv, const byte *input, size_t length, byte *output,
+                             const AESKey &key) const
+  {
+    size_t units = length / this->Nstate_; // no partial block in ECB / CBC cipher text, CTR handles it below
+    if (this->mode_ == MODE::CTR)
+      units = (length + this->Nstate_ - 1) / this->Nstate_;
+    size_t chunks = std::min<size_t>(pool.GetThreads(), length / g_bulkChunkBytes);
+    if (chunks < 2)
+    {
+      return this->_decryptBytes(iv, input, length, output, key, false);
+    }
+
+    // CBC : every slice chains on the last cipher block of the previous one. they are saved before any thread
+    // starts because with output == input the previous slice overwrites them
+    std::vector<byte> chains(chunks * this->Nstate_);
+    if (this->mode_ == MODE::CBC)
+    {
+      std::copy(iv, iv + this->Nstate_, chains.begin());
+      for (size_t chunk = 1; chunk < chunks; chunk++)
+      {
+        size_t begin = units * chunk / chunks * this->Nstate_;
+        std::copy(input + begin - this->Nstate_, input + begin, chains.begin() + chunk * this->Nstate_);
+      }
+    }
+
+    pool.Run(chunks, [&](size_t chunk) {
+      size_t begin = units * chunk / chunks * this->Nstate_;
+      size_t end = std::min(units * (chunk + 1) / chunks * this->Nstate_, length);
+      byte *chain = chains.data() + chunk * this->Nstate_;
+      if (this->mode_ == MODE::CTR)
+      {
+        std::copy(iv, iv + this->Nstate_, chain);
+        addCounter(chain, begin / this->Nstate_);
+      }
+      this->_decryptBytes(chain, input + begin, end - begin, output + begin, key, false);
+    });
+    return this->mode_ == MODE::CTR ? length : units * this->Nstate_;
+  }
+
+  size_t AES::bulkEncryption(const byte *iv, const byte *input, size_t length, byte *output, const AESKey &key) const
+  {
+    if (this->mode_ == MODE::CBC || length < 2 * g_bulkChunkBytes)
+    {
+      return this->_encryptBytes(iv, input, length, output, key, false);
+    }
+    return this->bulkEncryption(VpnThreadPool::GetDefault(), iv, input, length, output, key);
+  }
+
+  size_t AES::bulkDecryption(const byte *iv, const byte *input, size_t length, byte *output, const AESKey &key) const
+  {
+    if (length < 2 * g_bulkChunkBytes)
+    {
+      return this->_decryptBytes(iv, input, length, output, key, false);
+    }
+    return this->bulkDecryption(VpnThreadPool::GetDefault(), iv, input, length, output, key);
+  }
+
+  std::string AES::encryption(const std::string &input, const std::string &cipherKey, bool verbose) const
+  {
+    assert(cipherKey.size() == this->Nkey_ * 4 * 2); // check cipherKey(str) size == 128 / 192 / 256 bits * 2
+
+    return this->encryption(input, AESKey(cipherKey), verbose);
+  }
+
+  std::string AES::encryption(const std::string &input, const AESKey &key, bool verbose) const
+  {
+    std::string cipherText = "";
+    std::vector<byte> plainText = this->_convertTypeStrToByteBlock(input);
+
+    std::vector<byte> out(this->getPaddedLength(plainText.size()));
+    size_t out_len = this->encryption(plainText.data(), plainText.size(), out.data(), key, verbose);
+
+    if (this->mode_ == MODE::CTR)
+    {
+      cipherText = this->_convertTypeBytesToStr(out.data(), out_len);
+    }
+    else
+    {
+      for (size_t i = 0; i < out_len; i += this->Nstate_)
+      {
+        cipherText += this->_convertTypeByteStateToStr(&out[i], false);
+      }
+    }
+
+    if (verbose)
+    {
+      std::cout << "\n --- Cipher Text --- \n";
+      uint32_t i = 0;
+      for (auto &c : cipherText)
+      {
+        std::cout << c;
+        i++;
+        if (i % (this->Nstate_ * 2) == 0)
+          std::cout << "\n";
+      }
+      std::cout << "\n";
+    }
+
+    return cipherText;
+  }
+
+  std::string AES::decryption(const std::string &input, const std::string &cipherKey, bool verbose) const
+  {
+    assert(cipherKey.size() == this->Nkey_ * 4 * 2); // check cipherKey(str) size == 128 / 192 / 256 bits * 2
+
+    return this->decryption(input, AESKey(cipherKey), verbose);
+  }
+
+  std::string AES::decryption(const std::string &input, const AESKey &key, bool verbose) const
+  {
+    std::string plainText = "";
+    std::vector<byte> cipherText = this->_convertTypeStrToByteBlock(input);
+
+    size_t out_len = this->decryption(cipherText.data(), cipherText.size(), cipherText.data(), key, verbose);
+
+    if (this->mode_ == MODE::CTR)
+    {
+      plainText = this->_convertTypeBytesToStr(cipherText.data(), out_len);
+    }
+    else
+    {
+      for (size_t i = 0; i < out_len; i += this->Nstate_)
+      {
+        plainText += this->_convertTypeByteStateToStr(&cipherText[i], true);
+      }
     }
 
     if (verbose)
@@ -567,7 +1681,7 @@ namespace ns3
     return plainText;
   }
 
-  std::string AES::_convertCharToStrHex(const char &c)
+  std::string AES::_convertCharToStrHex(const char &c) const
   {
     std::string ret = "";
 
@@ -586,7 +1700,7 @@ namespace ns3
     return ret;
   }
 
-  std::string AES::convertStrToHexStr(const std::string &str)
+  std::string AES::convertStrToHexStr(const std::string &str) const
   {
     std::string ret;
 
@@ -598,7 +1712,7 @@ namespace ns3
     return ret;
   }
 
-  std::string AES::convertHexStrToStr(const std::string &hex)
+  std::string AES::convertHexStrToStr(const std::string &hex) const
   {
     std::string ret;
 
@@ -624,4 +1738,104 @@ namespace ns3
     return ret;
   }
 
+  AESStream::AESStream(const AES &aes, const AESKey &key)
+      : aes_(&aes), key_(&key), encrypt_(true), bufferLength_(0)
+  {
+    assert(aes.mode_ != MODE::GCM); // GCM needs a tag, use encryptAndTag / decryptAndVerify
+    std::fill(this->chain_, this->chain_ + 16, 0);
+  }
+
+  void AESStream::init(bool encrypt, const byte *iv)
+  {
+    this->encrypt_ = encrypt;
+    this->bufferLength_ = 0;
+    if (this->aes_->mode_ != MODE::ECB)
+      std::copy(iv, iv + 16, this->chain_);
+  }
+
+  // whole blocks of ECB / CBC, chain_ follows the last cipher block
+  void AESStream::_process(const byte *input, size_t length, byte *output)
+  {
+    if (this->encrypt_)
+    {
+      this->aes_->_encryptBytes(this->chain_, input, length, output, *this->key_, false);
+      if (this->aes_->mode_ == MODE::CBC)
+        std::copy(output + length - 16, output + length, this->chain_);
+      return;
+    }
+
+    byte next[16]; // input may be overwritten (in-place)
+    std::copy(input + length - 16, input + length, next);
+    this->aes_->_decryptBytes(this->chain_, input, length, output, *this->key_, false);
+    if (this->aes_->mode_ == MODE::CBC)
+      std::copy(next, next + 16, this->chain_);
+  }
+
+  size_t AESStream::update(const byte *input, size_t length, byte *output)
+  {
+    if (this->aes_->mode_ == MODE::CTR)
+    {
+      size_t i = 0;
+      for (; i < length && this->bufferLength_ != 0; i++, this->bufferLength_--)
+        output[i] = input[i] ^ this->buffer_[16 - this->bufferLength_];
+
+      size_t full = (length - i) / 16 * 16;
+      if (full != 0)
+      {
+        this->aes_->_ctrCrypt(this->chain_, input + i, full, output + i, *this->key_, false);
+        addCounter(this->chain_, full / 16);
+        i += full;
+      }
+
+      if (i != length)
+      {
+        std::copy(this->chain_, this->chain_ + 16, this->buffer_);
+        this->aes_->_encryptKeystream(this->buffer_, 1, *this->key_, false);
+        this->aes_->_incrementCounter(this->chain_);
+        for (this->bufferLength_ = 16; i < length; i++, this->bufferLength_--)
+          output[i] = input[i] ^ this->buffer_[16 - this->bufferLength_];
+      }
+      return length;
+    }
+
+    size_t written = 0;
+    if (this->bufferLength_ != 0)
+    {
+      size_t take = std::min<size_t>(16 - this->bufferLength_, length);
+      std::copy(input, input + take, this->buffer_ + this->bufferLength_);
+      this->bufferLength_ += take;
+      input += take;
+      length -= take;
+      if (this->bufferLength_ != 16)
+        return 0;
+
+      this->_process(this->buffer_, 16, output);
+      this->bufferLength_ = 0;
+      written = 16;
+    }
+
+    size_t full = length / 16 * 16;
+    if (full != 0)
+    {
+      this->_process(input, full, output + written);
+      written += full;
+    }
+
+    this->bufferLength_ = length - full;
+    std::copy(input + full, input + length, this->buffer_);
+    return written;
+  }
+
+  size_t AESStream::final(byte *output)
+  {
+    size_t written = 0;
+    if (this->aes_->mode_ != MODE::CTR && this->encrypt_ && this->bufferLength_ != 0)
+    {
+      this->aes_->_encryptBytes(this->chain_, this->buffer_, this->bufferLength_, output, *this->key_, false);
+      written = 16;
+    }
+    this->bufferLength_ = 0;
+    return written;
+  }
+
 }
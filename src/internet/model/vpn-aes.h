@@ -1,6 +1,8 @@
 /* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
 #ifndef VPN_AES_H
 #define VPN_AES_H
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -10,14 +12,68 @@ namespace ns3
 
   using byte = uint8_t;
 
+  class VpnThreadPool;
+
   typedef enum BlockCipherMode
   {
     ECB,
     CBC,
+    CTR, // counter mode : no padding, the initialization vector is the first counter block
+    GCM, // Galois/counter mode : authenticated encryption, only through encryptAndTag / decryptAndVerify
   } MODE;
 
+  typedef enum BlockCipherEngine
+  {
+    PORTABLE, // byte-wise reference rounds (the only engine printing verbose steps)
+    TTABLE,   // SubBytes/ShiftRows/MixColumns fused into 32-bit lookup tables
+    AESNI,    // x86 AES-NI instructions (falls back like AUTO if the CPU lacks them)
+    BITSLICE, // constant-time bitsliced SSE2 rounds on 8 blocks at once, no table lookups
+    AUTO,     // AESNI, else BITSLICE, else TTABLE : table lookups only where no constant-time engine builds
+  } ENGINE;
+
+  // expanded AES key schedule. built once per cipher key and shared by every encryption/decryption call
+  class AESKey
+  {
+  private:
+    uint8_t Nkey_;            // the number of 32 bits(4 bytes) words in cipher key (0 if empty)
+    uint8_t Nround_;          // the number of round
+    byte roundKey_[16 * 15]; // Nstate x (Nround + 1), enough for AES256
+    byte invRoundKey_[16 * 15]; // decryption round keys of the equivalent inverse cipher, same layout
+
+    void _expandKey(const byte *cipherKey);
+
+  public:
+    AESKey();
+    explicit AESKey(const std::string &cipherKey); // hex string of 128 / 192 / 256 bits key
+    AESKey(const byte *cipherKey, size_t keyBits);
+
+    bool isValid() const;
+    size_t getKeyBits() const;
+    uint8_t getRounds() const;
+    const byte *getRoundKey() const;
+    const byte *getInvRoundKey() const; // reverse order, InvMixColumns applied to all but the first and last
+  };
+
+  // one message of the AES batch interface (AES::encryptBatch / decryptBatch)
+  struct AESMessage
+  {
+    const byte *iv;    // CBC iv / CTR first counter block (16 bytes), GCM iv (12 bytes), unused in ECB
+    const byte *aad;   // GCM additional authenticated data
+    size_t aadLength;
+    const byte *input;
+    size_t length;
+    byte *output;      // may be the same buffer as input
+    byte *tag;         // GCM tag (16 bytes), written by encryptBatch and checked by decryptBatch
+    size_t outLength;  // set by the batch call : the number of bytes written to output
+    bool ok;           // set by the batch call : false if the GCM tag did not match (output untouched)
+  };
+
   class AES
   {
+    friend class AESKey;
+    friend class AESStream;
+    friend struct AESTTables;
+
   private:
     const uint8_t Bsize_ = 4;   // the number of 32 bits(4 bytes) words in block state
     const uint8_t Ncol_ = 4;    // the column size of state matrix
@@ -25,83 +81,189 @@ namespace ns3
     const uint8_t Nkey_;        // the number of 32 bits(4 bytes) words in cipher key
     const uint8_t Nround_;      // the number of round
     MODE mode_;
-    std::vector<byte> iv_;   // initialization vector (it is used if CBC mode)
-    std::vector<byte> phiv_; // placeholder for saving prev iv
-
-    const byte sbox_[256] = {
-        0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
-        0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
-        0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
-        0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
-        0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
-        0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
-        0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
-        0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
-        0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
-        0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
-        0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
-        0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
-        0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
-        0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
-        0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
-        0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16};
-    const byte inv_sbox_[256] = {
-        0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb,
-        0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87, 0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb,
-        0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e,
-        0x08, 0x2e, 0xa1, 0x66, 0x28, 0xd9, 0x24, 0xb2, 0x76, 0x5b, 0xa2, 0x49, 0x6d, 0x8b, 0xd1, 0x25,
-        0x72, 0xf8, 0xf6, 0x64, 0x86, 0x68, 0x98, 0x16, 0xd4, 0xa4, 0x5c, 0xcc, 0x5d, 0x65, 0xb6, 0x92,
-        0x6c, 0x70, 0x48, 0x50, 0xfd, 0xed, 0xb9, 0xda, 0x5e, 0x15, 0x46, 0x57, 0xa7, 0x8d, 0x9d, 0x84,
-        0x90, 0xd8, 0xab, 0x00, 0x8c, 0xbc, 0xd3, 0x0a, 0xf7, 0xe4, 0x58, 0x05, 0xb8, 0xb3, 0x45, 0x06,
-        0xd0, 0x2c, 0x1e, 0x8f, 0xca, 0x3f, 0x0f, 0x02, 0xc1, 0xaf, 0xbd, 0x03, 0x01, 0x13, 0x8a, 0x6b,
-        0x3a, 0x91, 0x11, 0x41, 0x4f, 0x67, 0xdc, 0xea, 0x97, 0xf2, 0xcf, 0xce, 0xf0, 0xb4, 0xe6, 0x73,
-        0x96, 0xac, 0x74, 0x22, 0xe7, 0xad, 0x35, 0x85, 0xe2, 0xf9, 0x37, 0xe8, 0x1c, 0x75, 0xdf, 0x6e,
-        0x47, 0xf1, 0x1a, 0x71, 0x1d, 0x29, 0xc5, 0x89, 0x6f, 0xb7, 0x62, 0x0e, 0xaa, 0x18, 0xbe, 0x1b,
-        0xfc, 0x56, 0x3e, 0x4b, 0xc6, 0xd2, 0x79, 0x20, 0x9a, 0xdb, 0xc0, 0xfe, 0x78, 0xcd, 0x5a, 0xf4,
-        0x1f, 0xdd, 0xa8, 0x33, 0x88, 0x07, 0xc7, 0x31, 0xb1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xec, 0x5f,
-        0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d, 0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef,
-        0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61,
-        0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d};
-    const byte rcon_[11] = {
-        0xFF, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36};
-
-    std::vector<byte> _createState(const std::vector<byte> &block, uint32_t start);
-    std::vector<byte> _expandKey(const std::vector<byte> &cipherKey, bool verbose);
-    void _addRoundKey(std::vector<byte> &state, const std::vector<byte> &roundKey, uint8_t round, bool verbose);
-
-    void _xor_iv(std::vector<byte> &state, std::vector<byte> &iv, bool verbose);
-
-    void _encryption(std::vector<byte> &state, const std::vector<byte> &roundKey, bool verbose);
-    byte _mappingSBox(const byte val);
-    void _subBytes(std::vector<byte> &state, bool verbose);
-    void _shiftRows(std::vector<byte> &statee, bool verbose);
-    void _mixColumns(std::vector<byte> &state, bool verbose);
-
-    void _decryption(std::vector<byte> &state, const std::vector<byte> &roundKey, bool verbose);
-    byte _mappingInvSBox(const byte val);
-    void _invSubBytes(std::vector<byte> &state, bool verbose);
-    void _invShiftRows(std::vector<byte> &state, bool verbose);
-    void _invMixColumns(std::vector<byte> &state, bool verbose);
-
-    std::string _convertTypeByteStateToStr(const std::vector<byte> &state, bool decryption);
-    std::vector<byte> _convertTypeStrToByteBlock(std::string str);
-    void _printState(const std::vector<byte> &state);
-    std::string _convertCharToStrHex(const char &c);
-    char _convertHexToChar(const byte hex);
+    ENGINE engine_;
+    std::vector<byte> iv_; // initialization vector (it is used if CBC / CTR mode)
+
+    static const byte sbox_[256];
+    static const byte inv_sbox_[256];
+    static const byte rcon_[11];
+
+    void _createState(byte *state, const byte *block, size_t length) const;
+    void _printRoundKey(const AESKey &key) const;
+    void _addRoundKey(byte *state, const byte *roundKey, uint8_t round, bool verbose) const;
+
+    void _xor_iv(byte *state, const byte *iv, bool verbose) const;
+
+    void _encryption(byte *state, const byte *roundKey, bool verbose) const;
+    byte _mappingSBox(const byte val) const;
+    void _subBytes(byte *state, bool verbose) const;
+    void _shiftRows(byte *state, bool verbose) const;
+    void _mixColumns(byte *state, bool verbose) const;
+
+    void _decryption(byte *state, const byte *roundKey, bool verbose) const;
+    void _eqDecryption(byte *state, const byte *invRoundKey, bool verbose) const;
+    byte _mappingInvSBox(const byte val) const;
+    void _invSubBytes(byte *state, bool verbose) const;
+    void _invShiftRows(byte *state, bool verbose) const;
+    void _invMixColumns(byte *state, bool verbose) const;
+
+    void _encryptBlock(byte *state, const AESKey &key, bool verbose) const;
+    void _decryptBlock(byte *state, const AESKey &key, bool verbose) const;
+
+    void _encryptTTable(byte *state, const byte *roundKey) const;
+    void _decryptTTable(byte *state, const byte *invRoundKey) const;
+
+    // AES-NI engine (vpn-aes-ni.cc), blocks are processed in full 16 bytes units
+    static bool _hasAESNI();
+    void _ecbEncryptNI(const byte *input, byte *output, size_t blocks, const byte *roundKey) const;
+    void _ecbDecryptNI(const byte *input, byte *output, size_t blocks, const byte *invRoundKey) const;
+    void _cbcEncryptNI(const byte *input, byte *output, size_t blocks, const byte *roundKey, byte *chain) const;
+    void _cbcDecryptNI(const byte *input, byte *output, size_t blocks, const byte *invRoundKey, byte *chain) const;
+
+    // bitsliced engine (vpn-aes-bitslice.cc)
+    static bool _hasBitslice();
+    void _ecbEncryptBS(const byte *input, byte *output, size_t blocks, const byte *roundKey) const;
+    void _ecbDecryptBS(const byte *input, byte *output, size_t blocks, const byte *roundKey) const;
+    void _cbcEncryptBS(const byte *input, byte *output, size_t blocks, const byte *roundKey, byte *chain) const;
+    void _cbcDecryptBS(const byte *input, byte *output, size_t blocks, const byte *roundKey, byte *chain) const;
+
+    // counter mode : keystream blocks are independent and encrypted several at once
+    size_t _ctrCrypt(const byte *counter0, const byte *input, size_t length, byte *output, const AESKey &key, bool verbose) const;
+    void _encryptKeystream(byte *blocks, size_t count, const AESKey &key, bool verbose) const;
+    void _incrementCounter(byte *counter) const;
+
+    // GHASH of GCM : PCLMULQDQ (vpn-aes-ni.cc) if the CPU has it, 4-bit multiplication table otherwise
+    struct GHashKey
+    {
+      byte h[16];      // hash subkey, E(K, 0^128)
+      uint64_t hh[16]; // H multiplied by every 4-bit value, high / low 64 bits
+      uint64_t hl[16];
+      bool clmul;
+    };
+    void _ghashInit(GHashKey &gkey, const AESKey &key) const;
+    void _ghashUpdate(byte *x, const byte *data, size_t length, const GHashKey &gkey) const;
+    void _ghashMultiply(byte *x, const GHashKey &gkey) const;
+    void _gcmHash(const byte *aad, size_t aadLength, const byte *cipherText, size_t length, byte *x, const GHashKey &gkey) const;
+    void _gcmTag(const byte *j0, const byte *aad, size_t aadLength, const byte *cipherText, size_t length, byte *tag, const AESKey &key) const;
+    static bool _hasCLMUL();
+    void _ghashCLMUL(byte *x, const byte *h, const byte *blocks, size_t count) const;
+
+    // whole payload in the mode of this object, iv is the CBC iv / first CTR counter block (unused in ECB)
+    size_t _encryptBytes(const byte *iv, const byte *input, size_t length, byte *output, const AESKey &key, bool verbose) const;
+    size_t _decryptBytes(const byte *iv, const byte *input, size_t length, byte *output, const AESKey &key, bool verbose) const;
+
+    // counter mode over several messages, 8 keystream blocks per engine call regardless of message boundaries.
+    // counters holds the first counter block of every message, messages with ok == false are skipped
+    void _ctrBatch(AESMessage *messages, size_t count, const byte *counters, const AESKey &key) const;
+    // CTR / GCM part of the batch interface for up to CTR_GROUP messages, counter blocks on the stack
+    static const size_t CTR_GROUP = 32;
+    void _ctrEncryptGroup(AESMessage *messages, size_t count, const AESKey &key, const GHashKey &gkey) const;
+    void _ctrDecryptGroup(AESMessage *messages, size_t count, const AESKey &key, const GHashKey &gkey) const;
+    // ECB in both directions and CBC decryption over several messages : their blocks are independent and share the
+    // 8 lanes of one engine call the same way. CBC encryption chains every block, so it runs one message per lane
+    void _blockBatch(AESMessage *messages, size_t count, const AESKey &key, bool encrypt) const;
+    void _cbcEncryptBatch(AESMessage *messages, size_t count, const AESKey &key) const;
+    void _decryptBlocks(byte *blocks, size_t count, const AESKey &key) const; // in place, like _encryptKeystream
+
+    // whole-block processing of the multi-block engines (AESNI, BITSLICE)
+    void _bulkEncrypt(const byte *input, byte *output, size_t blocks, const AESKey &key, byte *chain) const;
+    void _bulkDecrypt(const byte *input, byte *output, size_t blocks, const AESKey &key, byte *chain) const;
+
+    std::string _convertTypeByteStateToStr(const byte *state, bool decryption) const;
+    std::string _convertTypeBytesToStr(const byte *bytes, size_t length) const;
+    static std::vector<byte> _convertTypeStrToByteBlock(std::string str); // empty if str is not hex
+    void _printState(const byte *state) const;
+    std::string _convertCharToStrHex(const char &c) const;
+    char _convertHexToChar(const byte hex) const;
 
   public:
     AES() = delete;
-    AES(size_t keyBits, MODE mode = MODE::ECB);
+    AES(size_t keyBits, MODE mode = MODE::ECB, ENGINE engine = ENGINE::AUTO);
+
+    void setEngine(ENGINE engine); // AUTO and unsupported engines are resolved to what this CPU can run
+    ENGINE getEngine() const;
 
     void setIV(uint32_t seed);
     void setIV(std::vector<byte> iv);
     std::vector<byte> getIV() const;
 
-    std::string encryption(const std::string &input, const std::string &cipherKey, bool verbose = false);
-    std::string decryption(const std::string &input, const std::string &cipherKey, bool verbose = false);
+    // hex string interface (thin wrapper on top of the byte interface below)
+    std::string encryption(const std::string &input, const std::string &cipherKey, bool verbose = false) const;
+    std::string decryption(const std::string &input, const std::string &cipherKey, bool verbose = false) const;
+    std::string encryption(const std::string &input, const AESKey &key, bool verbose = false) const;
+    std::string decryption(const std::string &input, const AESKey &key, bool verbose = false) const;
+
+    // byte interface : cipherKey is Nkey * 4 raw bytes, output may be the same buffer as input (in-place).
+    // ECB / CBC encryption pads an incomplete last block (PKCS#7), so output needs getPaddedLength(length) bytes.
+    // CTR output has the same length as the input
+    // returns the number of bytes written to output
+    size_t encryption(const byte *input, size_t length, byte *output, const byte *cipherKey, bool verbose = false) const;
+    size_t decryption(const byte *input, size_t length, byte *output, const byte *cipherKey, bool verbose = false) const;
+    size_t encryption(const byte *input, size_t length, byte *output, const AESKey &key, bool verbose = false) const;
+    size_t decryption(const byte *input, size_t length, byte *output, const AESKey &key, bool verbose = false) const;
+    size_t getPaddedLength(size_t length) const;
+
+    // reentrant byte interface : the iv / first counter block is passed per call (ignored in ECB) and the object
+    // is not modified, so one AES and one AESKey can be shared by several threads
+    size_t encryption(const byte *iv, const byte *input, size_t length, byte *output, const AESKey &key) const;
+    size_t decryption(const byte *iv, const byte *input, size_t length, byte *output, const AESKey &key) const;
+
+    // batch interface : count independent messages under one key. the blocks of all messages are fed to the engine
+    // together (CTR / GCM keystream, ECB, CBC decryption) or as one CBC chain per lane (CBC encryption), so the
+    // AES-NI and bitslice pipelines stay full across message boundaries. GCM builds its GHASH key once per batch.
+    // nothing is allocated, the working state is on the stack
+    void encryptBatch(AESMessage *messages, size_t count, const AESKey &key) const;
+    void decryptBatch(AESMessage *messages, size_t count, const AESKey &key) const;
+
+    // same as the reentrant interface, large buffers are split across the threads of pool. ECB and CTR in both
+    // directions and CBC decryption run in parallel, CBC encryption chains every block and stays on this thread
+    size_t bulkEncryption(VpnThreadPool &pool, const byte *iv, const byte *input, size_t length, byte *output,
+                          const AESKey &key) const;
+    size_t bulkDecryption(VpnThreadPool &pool, const byte *iv, const byte *input, size_t length, byte *output,
+                          const AESKey &key) const;
+    // same on VpnThreadPool::GetDefault, which is only started once a buffer is large enough to be split
+    size_t bulkEncryption(const byte *iv, const byte *input, size_t length, byte *output, const AESKey &key) const;
+    size_t bulkDecryption(const byte *iv, const byte *input, size_t length, byte *output, const AESKey &key) const;
+
+    // GCM interface (MODE::GCM) : encrypts and authenticates in one call, output has the same length as input.
+    // iv is 12 bytes (96 bits) and must never repeat for one key, tag is 16 bytes.
+    // decryptAndVerify checks the tag before decrypting and leaves output untouched if it does not match.
+    void encryptAndTag(const byte *iv, const byte *aad, size_t aadLength, const byte *input, size_t length,
+                       byte *output, byte *tag, const AESKey &key) const;
+    bool decryptAndVerify(const byte *iv, const byte *aad, size_t aadLength, const byte *input, size_t length,
+                          byte *output, const byte *tag, const AESKey &key) const;
+
+    std::string convertStrToHexStr(const std::string &str) const;
+    std::string convertHexStrToStr(const std::string &hex) const;
+  };
+
+  // incremental ECB / CBC / CTR : init with the iv, update over chunks of any size, then final. the partial
+  // block and the CBC chain / CTR counter are carried between update calls, so a payload spread over several
+  // buffers (packet fragments) gives the same output as one encryption call over the concatenated bytes.
+  // the AES object and the key are referenced, not copied, and have to outlive the stream
+  class AESStream
+  {
+  private:
+    const AES *aes_;
+    const AESKey *key_;
+    bool encrypt_;
+    byte chain_[16];      // CBC previous cipher block / CTR next counter block
+    byte buffer_[16];     // ECB / CBC bytes of the incomplete block, CTR keystream block
+    uint8_t bufferLength_; // ECB / CBC bytes held in buffer_, CTR keystream bytes not used yet
+
+    void _process(const byte *input, size_t length, byte *output);
+
+  public:
+    AESStream(const AES &aes, const AESKey &key);
 
-    std::string convertStrToHexStr(const std::string &str);
-    std::string convertHexStrToStr(const std::string &hex);
+    // encrypt selects the direction, iv is the CBC iv / first CTR counter block (ignored in ECB)
+    void init(bool encrypt, const byte *iv);
+    // returns the number of bytes written to output, which needs length + 15 bytes in ECB / CBC.
+    // CTR writes exactly length bytes and may run in place, ECB / CBC only if every chunk is block aligned
+    size_t update(const byte *input, size_t length, byte *output);
+    // ECB / CBC encryption pads and writes the incomplete last block (16 bytes), decryption drops an incomplete
+    // block like AES::decryption does. returns the number of bytes written, the stream needs init again after
+    size_t final(byte *output);
   };
 
 }
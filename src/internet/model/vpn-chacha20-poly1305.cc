@@ -0,0 +1,503 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+
+// ChaCha20-Poly1305 (RFC 8439). the ChaCha20 keystream keeps one 32-bit state word of 4 (SSE2) or 8 (AVX2)
+// consecutive blocks per vector register, so all quarter rounds run on several blocks at once. the vector
+// functions are compiled with the target attribute and only called after the CPU reported the instruction set.
+// Poly1305 uses 26-bit limbs so every product fits in 64 bits.
+
+#include "vpn-chacha20-poly1305.h"
+#include <cassert>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define VPN_CHACHA_SIMD 1
+#include <immintrin.h>
+#define SSE2_TARGET __attribute__((target("sse2")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define GETU32LE(p) \
+  ((uint32_t) (p)[0] | ((uint32_t) (p)[1] << 8) | ((uint32_t) (p)[2] << 16) | ((uint32_t) (p)[3] << 24))
+#define PUTU32LE(p, v)             \
+  {                                \
+    (p)[0] = (byte) (v);           \
+    (p)[1] = (byte) ((v) >> 8);    \
+    (p)[2] = (byte) ((v) >> 16);   \
+    (p)[3] = (byte) ((v) >> 24);   \
+  }
+#define QUARTERROUND(a, b, c, d) \
+  a += b;                        \
+  d ^= a;                        \
+  d = ROTL32 (d, 16);            \
+  c += d;                        \
+  b ^= c;                        \
+  b = ROTL32 (b, 12);            \
+  a += b;                        \
+  d ^= a;                        \
+  d = ROTL32 (d, 8);             \
+  c += d;                        \
+  b ^= c;                        \
+  b = ROTL32 (b, 7);
+
+namespace ns3
+{
+
+  const size_t ChaCha20Poly1305::Nblock_;
+  const size_t ChaCha20Poly1305::Ntag_;
+
+  // "expand 32-byte k"
+  static const uint32_t sigma[4] = {0x61707865, 0x3320646e, 0x79622d32, 0x6b206574};
+
+  ChaCha20Poly1305::ChaCha20Poly1305() : valid_(false)
+  {
+    memset(this->key_, 0, sizeof(this->key_));
+  }
+
+  ChaCha20Poly1305::ChaCha20Poly1305(const std::string &cipherKey) : valid_(false)
+  {
+    memset(this->key_, 0, sizeof(this->key_));
+    if (cipherKey.size() != 64)
+      return;
+
+    byte key[32];
+    for (int i = 0; i < 32; ++i)
+    {
+      byte b = 0;
+      for (int j = 0; j < 2; ++j)
+      {
+        char c = cipherKey[2 * i + j];
+        b <<= 4;
+        if (c >= '0' && c <= '9')
+          b |= c - '0';
+        else if (c >= 'a' && c <= 'f')
+          b |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+          b |= c - 'A' + 10;
+        else
+          return;
+      }
+      key[i] = b;
+    }
+    for (int i = 0; i < 8; ++i)
+      this->key_[i] = GETU32LE(key + 4 * i);
+    this->valid_ = true;
+  }
+
+  ChaCha20Poly1305::ChaCha20Poly1305(const byte *cipherKey) : valid_(true)
+  {
+    for (int i = 0; i < 8; ++i)
+      this->key_[i] = GETU32LE(cipherKey + 4 * i);
+  }
+
+  bool ChaCha20Poly1305::isValid() const
+  {
+    return this->valid_;
+  }
+
+  // one 64 bytes keystream block as 16 little endian words
+  void ChaCha20Poly1305::_block(uint32_t counter, const byte *nonce, uint32_t *out) const
+  {
+    uint32_t in[16] = {sigma[0], sigma[1], sigma[2], sigma[3],
+                       this->key_[0], this->key_[1], this->key_[2], this->key_[3],
+                       this->key_[4], this->key_[5], this->key_[6], this->key_[7],
+                       counter, GETU32LE(nonce), GETU32LE(nonce + 4), GETU32LE(nonce + 8)};
+    uint32_t x[16];
+    memcpy(x, in, sizeof(x));
+
+    for (int i = 0; i < 10; ++i)
+    {
+      // column rounds
+      QUARTERROUND(x[0], x[4], x[8], x[12]);
+      QUARTERROUND(x[1], x[5], x[9], x[13]);
+      QUARTERROUND(x[2], x[6], x[10], x[14]);
+      QUARTERROUND(x[3], x[7], x[11], x[15]);
+      // diagonal rounds
+      QUARTERROUND(x[0], x[5], x[10], x[15]);
+      QUARTERROUND(x[1], x[6], x[11], x[12]);
+      QUARTERROUND(x[2], x[7], x[8], x[13]);
+      QUARTERROUND(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; ++i)
+      out[i] = x[i] + in[i];
+  }
+
+  void ChaCha20Poly1305::_crypt(uint32_t counter, const byte *nonce, const byte *input, size_t length, byte *output) const
+  {
+    size_t blocks = length / this->Nblock_;
+    size_t done = 0;
+    if (_hasAVX2())
+      done = this->_cryptAVX2(counter, nonce, input, blocks, output);
+    else if (_hasSSE2())
+      done = this->_cryptSSE2(counter, nonce, input, blocks, output);
+
+    // remaining blocks and the partial tail one block at a time
+    for (size_t offset = done * this->Nblock_; offset < length; offset += this->Nblock_)
+    {
+      uint32_t ks[16];
+      byte stream[64];
+      this->_block(counter + (uint32_t) (offset / this->Nblock_), nonce, ks);
+      for (int i = 0; i < 16; ++i)
+        PUTU32LE(stream + 4 * i, ks[i]);
+
+      size_t n = length - offset < this->Nblock_ ? length - offset : this->Nblock_;
+      for (size_t i = 0; i < n; ++i)
+        output[offset + i] = input[offset + i] ^ stream[i];
+    }
+  }
+
+  // Poly1305 over aad || pad16 || cipherText || pad16 || le64(aadLength) || le64(length)
+  void ChaCha20Poly1305::_poly1305(const byte *oneTimeKey, const byte *aad, size_t aadLength,
+                                   const byte *cipherText, size_t length, byte *tag) const
+  {
+    const uint32_t mask26 = 0x3ffffff;
+    // clamped r
+    uint32_t r0 = (GETU32LE(oneTimeKey + 0)) & 0x3ffffff;
+    uint32_t r1 = (GETU32LE(oneTimeKey + 3) >> 2) & 0x3ffff03;
+    uint32_t r2 = (GETU32LE(oneTimeKey + 6) >> 4) & 0x3ffc0ff;
+    uint32_t r3 = (GETU32LE(oneTimeKey + 9) >> 6) & 0x3f03fff;
+    uint32_t r4 = (GETU32LE(oneTimeKey + 12) >> 8) & 0x00fffff;
+    uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+    uint32_t h0 = 0, h1 = 0, h2 = 0, h3 = 0, h4 = 0;
+
+    // every message block is a full 16 bytes block here (the AEAD construction pads with zeros)
+    auto blocks = [&](const byte *m, size_t len) {
+      byte last[16];
+      while (len > 0)
+      {
+        if (len < 16)
+        {
+          memset(last, 0, sizeof(last));
+          memcpy(last, m, len);
+          m = last;
+          len = 16;
+        }
+        h0 += (GETU32LE(m + 0)) & mask26;
+        h1 += (GETU32LE(m + 3) >> 2) & mask26;
+        h2 += (GETU32LE(m + 6) >> 4) & mask26;
+        h3 += (GETU32LE(m + 9) >> 6) & mask26;
+        h4 += (GETU32LE(m + 12) >> 8) | (1 << 24);
+
+        uint64_t d0 = (uint64_t) h0 * r0 + (uint64_t) h1 * s4 + (uint64_t) h2 * s3 + (uint64_t) h3 * s2 + (uint64_t) h4 * s1;
+        uint64_t d1 = (uint64_t) h0 * r1 + (uint64_t) h1 * r0 + (uint64_t) h2 * s4 + (uint64_t) h3 * s3 + (uint64_t) h4 * s2;
+        uint64_t d2 = (uint64_t) h0 * r2 + (uint64_t) h1 * r1 + (uint64_t) h2 * r0 + (uint64_t) h3 * s4 + (uint64_t) h4 * s3;
+        uint64_t d3 = (uint64_t) h0 * r3 + (uint64_t) h1 * r2 + (uint64_t) h2 * r1 + (uint64_t) h3 * r0 + (uint64_t) h4 * s4;
+        uint64_t d4 = (uint64_t) h0 * r4 + (uint64_t) h1 * r3 + (uint64_t) h2 * r2 + (uint64_t) h3 * r1 + (uint64_t) h4 * r0;
+
+        uint32_t c = (uint32_t) (d0 >> 26);
+        h0 = (uint32_t) d0 & mask26;
+        d1 += c;
+        c = (uint32_t) (d1 >> 26);
+        h1 = (uint32_t) d1 & mask26;
+        d2 += c;
+        c = (uint32_t) (d2 >> 26);
+        h2 = (uint32_t) d2 & mask26;
+        d3 += c;
+        c = (uint32_t) (d3 >> 26);
+        h3 = (uint32_t) d3 & mask26;
+        d4 += c;
+        c = (uint32_t) (d4 >> 26);
+        h4 = (uint32_t) d4 & mask26;
+        h0 += c * 5;
+        c = h0 >> 26;
+        h0 &= mask26;
+        h1 += c;
+
+        m += 16;
+        len -= 16;
+      }
+    };
+
+    blocks(aad, aadLength);
+    blocks(cipherText, length);
+    byte lengths[16];
+    for (int i = 0; i < 8; ++i)
+    {
+      lengths[i] = (byte) ((uint64_t) aadLength >> (8 * i));
+      lengths[8 + i] = (byte) ((uint64_t) length >> (8 * i));
+    }
+    blocks(lengths, 16);
+
+    // fully carry h
+    uint32_t c = h1 >> 26;
+    h1 &= mask26;
+    h2 += c;
+    c = h2 >> 26;
+    h2 &= mask26;
+    h3 += c;
+    c = h3 >> 26;
+    h3 &= mask26;
+    h4 += c;
+    c = h4 >> 26;
+    h4 &= mask26;
+    h0 += c * 5;
+    c = h0 >> 26;
+    h0 &= mask26;
+    h1 += c;
+
+    // g = h - p, select h or g without branching
+    uint32_t g0 = h0 + 5;
+    c = g0 >> 26;
+    g0 &= mask26;
+    uint32_t g1 = h1 + c;
+    c = g1 >> 26;
+    g1 &= mask26;
+    uint32_t g2 = h2 + c;
+    c = g2 >> 26;
+    g2 &= mask26;
+    uint32_t g3 = h3 + c;
+    c = g3 >> 26;
+    g3 &= mask26;
+    uint32_t g4 = h4 + c - (1 << 26);
+
+    uint32_t select = (g4 >> 31) - 1;
+    g0 &= select;
+    g1 &= select;
+    g2 &= select;
+    g3 &= select;
+    g4 &= select;
+    select = ~select;
+    h0 = (h0 & select) | g0;
+    h1 = (h1 & select) | g1;
+    h2 = (h2 & select) | g2;
+    h3 = (h3 & select) | g3;
+    h4 = (h4 & select) | g4;
+
+    // h = (h + s) % 2^128
+    h0 = h0 | (h1 << 26);
+    h1 = (h1 >> 6) | (h2 << 20);
+    h2 = (h2 >> 12) | (h3 << 14);
+    h3 = (h3 >> 18) | (h4 << 8);
+    uint64_t f = (uint64_t) h0 + GETU32LE(oneTimeKey + 16);
+    PUTU32LE(tag + 0, (uint32_t) f);
+    f = (uint64_t) h1 + GETU32LE(oneTimeKey + 20) + (f >> 32);
+    PUTU32LE(tag + 4, (uint32_t) f);
+    f = (uint64_t) h2 + GETU32LE(oneTimeKey + 24) + (f >> 32);
+    PUTU32LE(tag + 8, (uint32_t) f);
+    f = (uint64_t) h3 + GETU32LE(oneTimeKey + 28) + (f >> 32);
+    PUTU32LE(tag + 12, (uint32_t) f);
+  }
+
+  void ChaCha20Poly1305::encryptAndTag(const byte *nonce, const byte *aad, size_t aadLength, const byte *input,
+                                       size_t length, byte *output, byte *tag) const
+  {
+    assert(this->valid_);
+
+    // the one-time Poly1305 key is the first half of keystream block 0, the payload starts at block 1
+    uint32_t ks[16];
+    byte oneTimeKey[32];
+    this->_block(0, nonce, ks);
+    for (int i = 0; i < 8; ++i)
+      PUTU32LE(oneTimeKey + 4 * i, ks[i]);
+
+    this->_crypt(1, nonce, input, length, output);
+    this->_poly1305(oneTimeKey, aad, aadLength, output, length, tag);
+  }
+
+  bool ChaCha20Poly1305::decryptAndVerify(const byte *nonce, const byte *aad, size_t aadLength, const byte *input,
+                                          size_t length, byte *output, const byte *tag) const
+  {
+    assert(this->valid_);
+
+    uint32_t ks[16];
+    byte oneTimeKey[32];
+    byte expected[16];
+    this->_block(0, nonce, ks);
+    for (int i = 0; i < 8; ++i)
+      PUTU32LE(oneTimeKey + 4 * i, ks[i]);
+    this->_poly1305(oneTimeKey, aad, aadLength, input, length, expected);
+
+    // constant-time compare
+    byte diff = 0;
+    for (size_t i = 0; i < this->Ntag_; ++i)
+      diff |= expected[i] ^ tag[i];
+    if (diff != 0)
+      return false;
+
+    this->_crypt(1, nonce, input, length, output);
+    return true;
+  }
+
+  void ChaCha20Poly1305::crypt(const byte *nonce, uint32_t counter, const byte *input, size_t length, byte *output) const
+  {
+    assert(this->valid_);
+    this->_crypt(counter, nonce, input, length, output);
+  }
+
+#ifdef VPN_CHACHA_SIMD
+
+  bool ChaCha20Poly1305::_hasSSE2()
+  {
+    static const bool supported = __builtin_cpu_supports("sse2");
+    return supported;
+  }
+
+  bool ChaCha20Poly1305::_hasAVX2()
+  {
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+  }
+
+#define SSE2_ROTL(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+#define SSE2_QR(a, b, c, d)            \
+  a = _mm_add_epi32(a, b);             \
+  d = SSE2_ROTL(_mm_xor_si128(d, a), 16); \
+  c = _mm_add_epi32(c, d);             \
+  b = SSE2_ROTL(_mm_xor_si128(b, c), 12); \
+  a = _mm_add_epi32(a, b);             \
+  d = SSE2_ROTL(_mm_xor_si128(d, a), 8);  \
+  c = _mm_add_epi32(c, d);             \
+  b = SSE2_ROTL(_mm_xor_si128(b, c), 7);
+
+  // 4 blocks per pass, x[i] holds word i of blocks counter .. counter+3
+  SSE2_TARGET size_t
+  ChaCha20Poly1305::_cryptSSE2(uint32_t counter, const byte *nonce, const byte *input, size_t blocks, byte *output) const
+  {
+    const uint32_t in[16] = {sigma[0], sigma[1], sigma[2], sigma[3],
+                             this->key_[0], this->key_[1], this->key_[2], this->key_[3],
+                             this->key_[4], this->key_[5], this->key_[6], this->key_[7],
+                             0, GETU32LE(nonce), GETU32LE(nonce + 4), GETU32LE(nonce + 8)};
+    size_t done = 0;
+    for (; done + 4 <= blocks; done += 4)
+    {
+      __m128i s[16], x[16];
+      for (int i = 0; i < 16; ++i)
+        s[i] = _mm_set1_epi32((int) in[i]);
+      uint32_t ctr = counter + (uint32_t) done;
+      s[12] = _mm_add_epi32(_mm_set1_epi32((int) ctr), _mm_set_epi32(3, 2, 1, 0));
+      for (int i = 0; i < 16; ++i)
+        x[i] = s[i];
+
+      for (int r = 0; r < 10; ++r)
+      {
+        SSE2_QR(x[0], x[4], x[8], x[12]);
+        SSE2_QR(x[1], x[5], x[9], x[13]);
+        SSE2_QR(x[2], x[6], x[10], x[14]);
+        SSE2_QR(x[3], x[7], x[11], x[15]);
+        SSE2_QR(x[0], x[5], x[10], x[15]);
+        SSE2_QR(x[1], x[6], x[11], x[12]);
+        SSE2_QR(x[2], x[7], x[8], x[13]);
+        SSE2_QR(x[3], x[4], x[9], x[14]);
+      }
+      for (int i = 0; i < 16; ++i)
+        x[i] = _mm_add_epi32(x[i], s[i]);
+
+      // transpose 4 words x 4 blocks at a time so each store is 16 bytes of one block
+      const byte *src = input + done * this->Nblock_;
+      byte *dst = output + done * this->Nblock_;
+      for (int i = 0; i < 16; i += 4)
+      {
+        __m128i t0 = _mm_unpacklo_epi32(x[i], x[i + 1]);
+        __m128i t1 = _mm_unpacklo_epi32(x[i + 2], x[i + 3]);
+        __m128i t2 = _mm_unpackhi_epi32(x[i], x[i + 1]);
+        __m128i t3 = _mm_unpackhi_epi32(x[i + 2], x[i + 3]);
+        __m128i k[4] = {_mm_unpacklo_epi64(t0, t1), _mm_unpackhi_epi64(t0, t1),
+                        _mm_unpacklo_epi64(t2, t3), _mm_unpackhi_epi64(t2, t3)};
+        for (int b = 0; b < 4; ++b)
+        {
+          __m128i m = _mm_loadu_si128((const __m128i *) (src + b * 64 + i * 4));
+          _mm_storeu_si128((__m128i *) (dst + b * 64 + i * 4), _mm_xor_si128(m, k[b]));
+        }
+      }
+    }
+    return done;
+  }
+
+#define AVX2_ROTL(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+#define AVX2_QR(a, b, c, d)                    \
+  a = _mm256_add_epi32(a, b);                  \
+  d = AVX2_ROTL(_mm256_xor_si256(d, a), 16);   \
+  c = _mm256_add_epi32(c, d);                  \
+  b = AVX2_ROTL(_mm256_xor_si256(b, c), 12);   \
+  a = _mm256_add_epi32(a, b);                  \
+  d = AVX2_ROTL(_mm256_xor_si256(d, a), 8);    \
+  c = _mm256_add_epi32(c, d);                  \
+  b = AVX2_ROTL(_mm256_xor_si256(b, c), 7);
+
+  // 8 blocks per pass, x[i] holds word i of blocks counter .. counter+7
+  AVX2_TARGET size_t
+  ChaCha20Poly1305::_cryptAVX2(uint32_t counter, const byte *nonce, const byte *input, size_t blocks, byte *output) const
+  {
+    const uint32_t in[16] = {sigma[0], sigma[1], sigma[2], sigma[3],
+                             this->key_[0], this->key_[1], this->key_[2], this->key_[3],
+                             this->key_[4], this->key_[5], this->key_[6], this->key_[7],
+                             0, GETU32LE(nonce), GETU32LE(nonce + 4), GETU32LE(nonce + 8)};
+    size_t done = 0;
+    for (; done + 8 <= blocks; done += 8)
+    {
+      __m256i s[16], x[16];
+      for (int i = 0; i < 16; ++i)
+        s[i] = _mm256_set1_epi32((int) in[i]);
+      uint32_t ctr = counter + (uint32_t) done;
+      s[12] = _mm256_add_epi32(_mm256_set1_epi32((int) ctr), _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+      for (int i = 0; i < 16; ++i)
+        x[i] = s[i];
+
+      for (int r = 0; r < 10; ++r)
+      {
+        AVX2_QR(x[0], x[4], x[8], x[12]);
+        AVX2_QR(x[1], x[5], x[9], x[13]);
+        AVX2_QR(x[2], x[6], x[10], x[14]);
+        AVX2_QR(x[3], x[7], x[11], x[15]);
+        AVX2_QR(x[0], x[5], x[10], x[15]);
+        AVX2_QR(x[1], x[6], x[11], x[12]);
+        AVX2_QR(x[2], x[7], x[8], x[13]);
+        AVX2_QR(x[3], x[4], x[9], x[14]);
+      }
+      for (int i = 0; i < 16; ++i)
+        x[i] = _mm256_add_epi32(x[i], s[i]);
+
+      // same 4x4 transpose as SSE2, the low 128-bit lane carries blocks 0..3 and the high lane blocks 4..7
+      const byte *src = input + done * this->Nblock_;
+      byte *dst = output + done * this->Nblock_;
+      for (int i = 0; i < 16; i += 4)
+      {
+        __m256i t0 = _mm256_unpacklo_epi32(x[i], x[i + 1]);
+        __m256i t1 = _mm256_unpacklo_epi32(x[i + 2], x[i + 3]);
+        __m256i t2 = _mm256_unpackhi_epi32(x[i], x[i + 1]);
+        __m256i t3 = _mm256_unpackhi_epi32(x[i + 2], x[i + 3]);
+        __m256i k[4] = {_mm256_unpacklo_epi64(t0, t1), _mm256_unpackhi_epi64(t0, t1),
+                        _mm256_unpacklo_epi64(t2, t3), _mm256_unpackhi_epi64(t2, t3)};
+        for (int b = 0; b < 4; ++b)
+        {
+          const byte *lo = src + b * 64 + i * 4;
+          const byte *hi = lo + 4 * 64;
+          __m128i mlo = _mm_loadu_si128((const __m128i *) lo);
+          __m128i mhi = _mm_loadu_si128((const __m128i *) hi);
+          _mm_storeu_si128((__m128i *) (dst + b * 64 + i * 4),
+                           _mm_xor_si128(mlo, _mm256_castsi256_si128(k[b])));
+          _mm_storeu_si128((__m128i *) (dst + (b + 4) * 64 + i * 4),
+                           _mm_xor_si128(mhi, _mm256_extracti128_si256(k[b], 1)));
+        }
+      }
+    }
+    return done;
+  }
+
+#else // VPN_CHACHA_SIMD
+
+  bool ChaCha20Poly1305::_hasSSE2()
+  {
+    return false;
+  }
+
+  bool ChaCha20Poly1305::_hasAVX2()
+  {
+    return false;
+  }
+
+  size_t ChaCha20Poly1305::_cryptSSE2(uint32_t, const byte *, const byte *, size_t, byte *) const
+  {
+    assert(false);
+    return 0;
+  }
+
+  size_t ChaCha20Poly1305::_cryptAVX2(uint32_t, const byte *, const byte *, size_t, byte *) const
+  {
+    assert(false);
+    return 0;
+  }
+
+#endif // VPN_CHACHA_SIMD
+
+}
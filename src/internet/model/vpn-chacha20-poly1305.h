@@ -0,0 +1,53 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+#ifndef VPN_CHACHA20_POLY1305_H
+#define VPN_CHACHA20_POLY1305_H
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace ns3
+{
+
+  using byte = uint8_t;
+
+  // ChaCha20-Poly1305 AEAD (RFC 8439). the keystream is generated 8 blocks at once with AVX2 or
+  // 4 blocks at once with SSE2 when the CPU has them, so it stays fast on hosts without AES instructions
+  class ChaCha20Poly1305
+  {
+  private:
+    static const size_t Nblock_ = 64; // the number of keystream bytes per ChaCha20 block
+    static const size_t Ntag_ = 16;   // the number of Poly1305 tag bytes
+    bool valid_;
+    uint32_t key_[8]; // 256 bits key as little endian words
+
+    void _block(uint32_t counter, const byte *nonce, uint32_t *out) const;
+    void _crypt(uint32_t counter, const byte *nonce, const byte *input, size_t length, byte *output) const;
+    void _poly1305(const byte *oneTimeKey, const byte *aad, size_t aadLength, const byte *cipherText, size_t length, byte *tag) const;
+
+    // vectorized keystream (vpn-chacha20-poly1305.cc), return the number of 64 bytes blocks processed
+    size_t _cryptSSE2(uint32_t counter, const byte *nonce, const byte *input, size_t blocks, byte *output) const;
+    size_t _cryptAVX2(uint32_t counter, const byte *nonce, const byte *input, size_t blocks, byte *output) const;
+    static bool _hasSSE2();
+    static bool _hasAVX2();
+
+  public:
+    ChaCha20Poly1305();                                  // empty key (invalid until a key is set)
+    explicit ChaCha20Poly1305(const std::string &cipherKey); // hex string of 256 bits key
+    explicit ChaCha20Poly1305(const byte *cipherKey);        // 32 bytes key
+
+    bool isValid() const;
+
+    // nonce is 12 bytes and must never repeat for one key, tag is 16 bytes, output may be the same buffer as input.
+    // decryptAndVerify checks the tag before decrypting and leaves output untouched if it does not match.
+    void encryptAndTag(const byte *nonce, const byte *aad, size_t aadLength, const byte *input, size_t length,
+                       byte *output, byte *tag) const;
+    bool decryptAndVerify(const byte *nonce, const byte *aad, size_t aadLength, const byte *input, size_t length,
+                          byte *output, const byte *tag) const;
+
+    // ChaCha20 stream only (no authentication), keystream block counter starts at 'counter'
+    void crypt(const byte *nonce, uint32_t counter, const byte *input, size_t length, byte *output) const;
+  };
+
+}
+
+#endif /* VPN_CHACHA20_POLY1305_H */
@@ -0,0 +1,341 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+#include "ns3/vpn-cipher.h"
+#include "ns3/vpn-aes.h"
+#include "ns3/vpn-chacha20-poly1305.h"
+#include "ns3/log.h"
+#include <cstring>
+#include <map>
+
+namespace ns3
+{
+  NS_LOG_COMPONENT_DEFINE("VpnCipher");
+
+  // AES in one of the block cipher modes, the key size is fixed by the suite name.
+  // CBC needs an unpredictable iv : it is E(K, nonce) and not the nonce itself (NIST SP 800-38A appendix C)
+  class AesVpnCipher : public VpnCipher
+  {
+  public:
+    AesVpnCipher(uint32_t keyBits, MODE mode)
+        : m_keyBits(keyBits),
+          m_mode(mode),
+          m_aes(keyBits, mode),
+          m_ivAes(keyBits, MODE::ECB)
+    {
+      std::memset(m_noTag, 0, sizeof(m_noTag));
+    }
+
+    virtual std::string GetName(void) const
+    {
+      static const char *modes[] = {"ECB", "CBC", "CTR", "GCM"};
+      return "AES-" + std::to_string(m_keyBits) + "-" + modes[m_mode];
+    }
+
+    virtual bool SetKey(const std::string &cipherKey)
+    {
+      if (cipherKey.size() != m_keyBits / 4 || cipherKey.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos)
+        return false;
+      m_key = AESKey(cipherKey);
+      return m_key.isValid();
+    }
+
+    virtual uint32_t GetKeySize(void) const
+    {
+      return m_keyBits / 8;
+    }
+
+    virtual uint32_t GetIvSize(void) const
+    {
+      switch (m_mode)
+      {
+      case MODE::ECB:
+        return 0;
+      case MODE::GCM:
+        return 12;
+      default:
+        return 16;
+      }
+    }
+
+    virtual uint32_t GetTagSize(void) const
+    {
+      return m_mode == MODE::GCM ? 16 : 0;
+    }
+
+    virtual uint32_t GetOverhead(uint32_t length) const
+    {
+      return m_aes.getPaddedLength(length) - length + GetTagSize();
+    }
+
+    virtual uint32_t Encrypt(const uint8_t *iv, const uint8_t *aad, uint32_t aadLength,
+                             const uint8_t *input, uint32_t length, uint8_t *output)
+    {
+      NS_ASSERT(m_key.isValid());
+      if (m_mode == MODE::GCM)
+      {
+        m_aes.encryptAndTag(iv, aad, aadLength, input, length, output, output + length, m_key);
+        return length + GetTagSize();
+      }
+      uint8_t cbcIv[16];
+      return m_aes.bulkEncryption(CbcIv(iv, cbcIv), input, length, output, m_key);
+    }
+
+    virtual bool Decrypt(const uint8_t *iv, const uint8_t *aad, uint32_t aadLength,
+                         const uint8_t *input, uint32_t length, uint8_t *output, uint32_t &outLength)
+    {
+      NS_ASSERT(m_key.isValid());
+      if (m_mode == MODE::GCM)
+      {
+        if (length < GetTagSize())
+          return false;
+        outLength = length - GetTagSize();
+        return m_aes.decryptAndVerify(iv, aad, aadLength, input, outLength, output, input + outLength, m_key);
+      }
+      uint8_t cbcIv[16];
+      outLength = m_aes.bulkDecryption(CbcIv(iv, cbcIv), input, length, output, m_key);
+      return true;
+    }
+
+    virtual void EncryptBatch(Message *messages, uint32_t count)
+    {
+      NS_ASSERT(m_key.isValid());
+      AESMessage *batch = Scratch(count);
+      for (uint32_t i = 0; i < count; i++)
+      {
+        batch[i] = ToAesMessage(messages[i]);
+        batch[i].tag = messages[i].output + messages[i].length;
+      }
+      CbcIvs(batch, count);
+      m_aes.encryptBatch(batch, count, m_key);
+      for (uint32_t i = 0; i < count; i++)
+      {
+        messages[i].outLength = batch[i].outLength + GetTagSize();
+        messages[i].ok = true;
+      }
+    }
+
+    virtual void DecryptBatch(Message *messages, uint32_t count)
+    {
+      NS_ASSERT(m_key.isValid());
+      AESMessage *batch = Scratch(count);
+      for (uint32_t i = 0; i < count; i++)
+      {
+        batch[i] = ToAesMessage(messages[i]);
+        if (m_mode != MODE::GCM)
+          continue;
+        if (messages[i].length < GetTagSize())
+        {
+          // too short to carry a tag : processed as an empty message and rejected below
+          batch[i].length = 0;
+          batch[i].tag = m_noTag;
+          continue;
+        }
+        batch[i].length -= GetTagSize();
+        batch[i].tag = const_cast<uint8_t *>(messages[i].input) + batch[i].length;
+      }
+      CbcIvs(batch, count);
+      m_aes.decryptBatch(batch, count, m_key);
+      for (uint32_t i = 0; i < count; i++)
+      {
+        messages[i].ok = batch[i].ok && (m_mode != MODE::GCM || messages[i].length >= GetTagSize());
+        messages[i].outLength = messages[i].ok ? batch[i].outLength : 0;
+      }
+    }
+
+  private:
+    // batch of count messages, kept for the next call
+    AESMessage *Scratch(uint32_t count)
+    {
+      if (m_batch.size() < count)
+        m_batch.resize(count);
+      return m_batch.data();
+    }
+
+    // CBC iv of one message into buffer, other modes use the nonce as it is
+    const uint8_t *CbcIv(const uint8_t *nonce, uint8_t *buffer) const
+    {
+      if (m_mode != MODE::CBC)
+        return nonce;
+      m_ivAes.encryption(nonce, nonce, 16, buffer, m_key);
+      return buffer;
+    }
+
+    // the same for a batch, all nonces in one engine call
+    void CbcIvs(AESMessage *batch, uint32_t count)
+    {
+      if (m_mode != MODE::CBC)
+        return;
+      if (m_ivs.size() < count * 16)
+        m_ivs.resize(count * 16);
+      for (uint32_t i = 0; i < count; i++)
+      {
+        std::memcpy(m_ivs.data() + i * 16, batch[i].iv, 16);
+        batch[i].iv = m_ivs.data() + i * 16;
+      }
+      m_ivAes.encryption(m_ivs.data(), m_ivs.data(), count * 16, m_ivs.data(), m_key);
+    }
+
+    static AESMessage ToAesMessage(const Message &message)
+    {
+      AESMessage aesMessage;
+      aesMessage.iv = message.iv;
+      aesMessage.aad = message.aad;
+      aesMessage.aadLength = message.aadLength;
+      aesMessage.input = message.input;
+      aesMessage.length = message.length;
+      aesMessage.output = message.output;
+      aesMessage.tag = 0;
+      aesMessage.outLength = 0;
+      aesMessage.ok = false;
+      return aesMessage;
+    }
+
+    uint32_t m_keyBits;
+    MODE m_mode;
+    AES m_aes;
+    AES m_ivAes; // ECB, for the CBC ivs
+    AESKey m_key;
+    std::vector<uint8_t> m_ivs; // CBC ivs of a batch, kept for the next one
+    std::vector<AESMessage> m_batch;
+    uint8_t m_noTag[16]; // read as the tag of messages too short to carry one
+  };
+
+  class ChaCha20Poly1305VpnCipher : public VpnCipher
+  {
+  public:
+    virtual std::string GetName(void) const
+    {
+      return "ChaCha20-Poly1305";
+    }
+
+    virtual bool SetKey(const std::string &cipherKey)
+    {
+      m_cipher = ChaCha20Poly1305(cipherKey);
+      return m_cipher.isValid();
+    }
+
+    virtual uint32_t GetKeySize(void) const
+    {
+      return 32;
+    }
+
+    virtual uint32_t GetIvSize(void) const
+    {
+      return 12;
+    }
+
+    virtual uint32_t GetTagSize(void) const
+    {
+      return 16;
+    }
+
+    virtual uint32_t GetOverhead(uint32_t) const
+    {
+      return GetTagSize();
+    }
+
+    virtual uint32_t Encrypt(const uint8_t *iv, const uint8_t *aad, uint32_t aadLength,
+                             const uint8_t *input, uint32_t length, uint8_t *output)
+    {
+      m_cipher.encryptAndTag(iv, aad, aadLength, input, length, output, output + length);
+      return length + GetTagSize();
+    }
+
+    virtual bool Decrypt(const uint8_t *iv, const uint8_t *aad, uint32_t aadLength,
+                         const uint8_t *input, uint32_t length, uint8_t *output, uint32_t &outLength)
+    {
+      if (length < GetTagSize())
+        return false;
+      outLength = length - GetTagSize();
+      return m_cipher.decryptAndVerify(iv, aad, aadLength, input, outLength, output, input + outLength);
+    }
+
+  private:
+    ChaCha20Poly1305 m_cipher;
+  };
+
+  template <uint32_t KeyBits, MODE Mode>
+  static Ptr<VpnCipher>
+  CreateAes(void)
+  {
+    return Create<AesVpnCipher>(KeyBits, Mode);
+  }
+
+  static Ptr<VpnCipher>
+  CreateChaCha20Poly1305(void)
+  {
+    return Create<ChaCha20Poly1305VpnCipher>();
+  }
+
+  // built-in suites are added on first use so Register/Create do not depend on static initialization order
+  static std::map<std::string, VpnCipher::Factory> &
+  GetRegistry(void)
+  {
+    static std::map<std::string, VpnCipher::Factory> registry = {
+        {"AES-128-ECB", &CreateAes<128, MODE::ECB>},
+        {"AES-192-ECB", &CreateAes<192, MODE::ECB>},
+        {"AES-256-ECB", &CreateAes<256, MODE::ECB>},
+        {"AES-128-CBC", &CreateAes<128, MODE::CBC>},
+        {"AES-192-CBC", &CreateAes<192, MODE::CBC>},
+        {"AES-256-CBC", &CreateAes<256, MODE::CBC>},
+        {"AES-128-CTR", &CreateAes<128, MODE::CTR>},
+        {"AES-192-CTR", &CreateAes<192, MODE::CTR>},
+        {"AES-256-CTR", &CreateAes<256, MODE::CTR>},
+        {"AES-128-GCM", &CreateAes<128, MODE::GCM>},
+        {"AES-192-GCM", &CreateAes<192, MODE::GCM>},
+        {"AES-256-GCM", &CreateAes<256, MODE::GCM>},
+        {"ChaCha20-Poly1305", &CreateChaCha20Poly1305},
+    };
+    return registry;
+  }
+
+  VpnCipher::~VpnCipher()
+  {
+  }
+
+  void VpnCipher::EncryptBatch(Message *messages, uint32_t count)
+  {
+    for (uint32_t i = 0; i < count; i++)
+    {
+      Message &message = messages[i];
+      message.outLength = Encrypt(message.iv, message.aad, message.aadLength, message.input, message.length, message.output);
+      message.ok = true;
+    }
+  }
+
+  void VpnCipher::DecryptBatch(Message *messages, uint32_t count)
+  {
+    for (uint32_t i = 0; i < count; i++)
+    {
+      Message &message = messages[i];
+      message.ok = Decrypt(message.iv, message.aad, message.aadLength, message.input, message.length, message.output, message.outLength);
+      if (!message.ok)
+        message.outLength = 0;
+    }
+  }
+
+  void VpnCipher::Register(const std::string &name, Factory factory)
+  {
+    NS_LOG_FUNCTION(name);
+    GetRegistry()[name] = factory;
+  }
+
+  Ptr<VpnCipher> VpnCipher::Create(const std::string &name)
+  {
+    std::map<std::string, Factory>::const_iterator it = GetRegistry().find(name);
+    if (it == GetRegistry().end())
+    {
+      NS_LOG_WARN("Unknown cipher suite " << name);
+      return 0;
+    }
+    return it->second();
+  }
+
+  std::vector<std::string> VpnCipher::GetNames(void)
+  {
+    std::vector<std::string> names;
+    for (const auto &entry : GetRegistry())
+      names.push_back(entry.first);
+    return names;
+  }
+
+}
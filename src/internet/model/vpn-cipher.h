@@ -0,0 +1,67 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+#ifndef VPN_CIPHER_H
+#define VPN_CIPHER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "ns3/ptr.h"
+#include "ns3/simple-ref-count.h"
+
+namespace ns3
+{
+
+  // cipher suite protecting a VPN tunnel. implementations are registered by name ("AES-128-GCM",
+  // "ChaCha20-Poly1305", ...) and created through VpnCipher::Create, so the application picks the suite
+  // from an attribute. Encrypt writes ciphertext || tag, suites without authentication have no tag.
+  class VpnCipher : public SimpleRefCount<VpnCipher>
+  {
+  public:
+    typedef Ptr<VpnCipher> (*Factory)(void);
+
+    // one packet of the batch interface, same buffers and rules as Encrypt / Decrypt
+    struct Message
+    {
+      const uint8_t *iv;
+      const uint8_t *aad;
+      uint32_t aadLength;
+      const uint8_t *input;
+      uint32_t length;
+      uint8_t *output;
+      uint32_t outLength; // set by the batch call
+      bool ok;            // set by the batch call, false if the tag did not match
+    };
+
+    virtual ~VpnCipher();
+
+    virtual std::string GetName(void) const = 0;
+    // key as hex string, returns false if the key does not fit the suite
+    virtual bool SetKey(const std::string &cipherKey) = 0;
+    virtual uint32_t GetKeySize(void) const = 0; // bytes
+    virtual uint32_t GetIvSize(void) const = 0;  // bytes of iv / nonce per message, 0 if none
+    virtual uint32_t GetTagSize(void) const = 0; // bytes of authentication tag, 0 if none
+    // extra bytes Encrypt produces over a plaintext of 'length' bytes (padding and tag)
+    virtual uint32_t GetOverhead(uint32_t length) const = 0;
+
+    // output needs length + GetOverhead(length) bytes and may be the same buffer as input.
+    // aad is only authenticated by suites with a tag. returns the number of bytes written
+    virtual uint32_t Encrypt(const uint8_t *iv, const uint8_t *aad, uint32_t aadLength,
+                             const uint8_t *input, uint32_t length, uint8_t *output) = 0;
+    // input is ciphertext || tag. returns false (output untouched) if the tag does not match.
+    // block modes without padding information return the block aligned length in outLength
+    virtual bool Decrypt(const uint8_t *iv, const uint8_t *aad, uint32_t aadLength,
+                         const uint8_t *input, uint32_t length, uint8_t *output, uint32_t &outLength) = 0;
+
+    // count independent packets under the current key. the default runs Encrypt / Decrypt per message,
+    // suites override it to keep their pipelines full across packets
+    virtual void EncryptBatch(Message *messages, uint32_t count);
+    virtual void DecryptBatch(Message *messages, uint32_t count);
+
+    static void Register(const std::string &name, Factory factory);
+    static Ptr<VpnCipher> Create(const std::string &name); // 0 if the name is unknown
+    static std::vector<std::string> GetNames(void);
+  };
+
+}
+
+#endif /* VPN_CIPHER_H */
@@ -0,0 +1,251 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+#include "ns3/vpn-header-compressor.h"
+#include "ns3/vpn-header.h"
+#include "ns3/header.h"
+#include "ns3/log.h"
+#include <algorithm>
+
+namespace ns3
+{
+  NS_LOG_COMPONENT_DEFINE("VpnHeaderCompressor");
+
+  const uint8_t VpnHeaderCompressor::MAX_CONTEXTS;
+  const uint32_t VpnHeaderCompressor::REFRESH;
+  const uint32_t VpnHeaderCompressor::HEADERS_SIZE;
+
+  // bytes put in front of a packet as they are, compressed or rebuilt headers
+  class VpnHeaderBytes : public Header
+  {
+  public:
+    static TypeId GetTypeId(void)
+    {
+      static TypeId tid = TypeId("ns3::VpnHeaderBytes")
+                              .SetParent<Header>()
+                              .AddConstructor<VpnHeaderBytes>();
+      return tid;
+    }
+
+    VpnHeaderBytes()
+        : m_length(0)
+    {
+    }
+
+    virtual TypeId GetInstanceTypeId(void) const
+    {
+      return GetTypeId();
+    }
+
+    virtual void Print(std::ostream &os) const
+    {
+      os << "length=" << m_length;
+    }
+
+    virtual uint32_t GetSerializedSize(void) const
+    {
+      return m_length;
+    }
+
+    virtual void Serialize(Buffer::Iterator start) const
+    {
+      start.Write(m_bytes, m_length);
+    }
+
+    virtual uint32_t Deserialize(Buffer::Iterator start)
+    {
+      start.Read(m_bytes, m_length);
+      return m_length;
+    }
+
+    uint8_t m_bytes[28];
+    uint32_t m_length;
+  };
+
+  NS_OBJECT_ENSURE_REGISTERED(VpnHeaderBytes);
+
+  static uint16_t
+  ReadU16(const uint8_t *bytes)
+  {
+    return (bytes[0] << 8) | bytes[1];
+  }
+
+  static void
+  WriteU16(uint8_t *bytes, uint16_t value)
+  {
+    bytes[0] = value >> 8;
+    bytes[1] = value & 0xff;
+  }
+
+  // same fields that never change within a context : version / ihl, tos, flags / fragment, ttl, protocol,
+  // addresses, ports and whether the ipv4 checksum is in use
+  static bool
+  SameContext(const uint8_t *a, const uint8_t *b)
+  {
+    return std::equal(a, a + 2, b) && std::equal(a + 6, a + 10, b + 6) && std::equal(a + 12, a + 24, b + 12) &&
+           ((a[10] | a[11]) != 0) == ((b[10] | b[11]) != 0);
+  }
+
+  // CRC-8 (x^8 + x^2 + x + 1) over the fields SameContext compares
+  static uint8_t
+  StaticCrc(const uint8_t *headers)
+  {
+    uint8_t fields[19];
+    std::copy(headers, headers + 2, fields);
+    std::copy(headers + 6, headers + 10, fields + 2);
+    std::copy(headers + 12, headers + 24, fields + 6);
+    fields[18] = (headers[10] | headers[11]) != 0;
+
+    uint8_t crc = 0xff;
+    for (uint32_t i = 0; i < sizeof(fields); i++)
+    {
+      crc ^= fields[i];
+      for (int bit = 0; bit < 8; bit++)
+        crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+    return crc;
+  }
+
+  VpnHeaderCompressor::VpnHeaderCompressor()
+      : m_nextContext(0)
+  {
+    for (uint8_t i = 0; i < MAX_CONTEXTS; i++)
+      m_contexts[i].valid = false;
+  }
+
+  uint8_t VpnHeaderCompressor::Compress(Ptr<Packet> packet, bool explicitLength)
+  {
+    uint32_t size = packet->GetSize();
+    uint8_t headers[HEADERS_SIZE];
+    if (size < HEADERS_SIZE)
+      return 0;
+    packet->CopyData(headers, HEADERS_SIZE);
+
+    // ipv4 without options or fragmentation carrying one whole udp datagram
+    if (headers[0] != 0x45 || headers[9] != 17 || (ReadU16(headers + 6) & 0x3fff) != 0 ||
+        ReadU16(headers + 2) != size || ReadU16(headers + 24) != size - 20)
+      return 0;
+
+    uint64_t flow = ((uint64_t(ReadU16(headers + 12)) << 48) | (uint64_t(ReadU16(headers + 14)) << 32) |
+                     (uint64_t(ReadU16(headers + 16)) << 16) | ReadU16(headers + 18)) ^
+                    ((uint64_t(ReadU16(headers + 20)) << 16 | ReadU16(headers + 22)) * 0x9E3779B97F4A7C15ULL);
+
+    uint8_t cid;
+    std::unordered_map<uint64_t, uint8_t>::iterator it = m_flows.find(flow);
+    if (it == m_flows.end())
+    {
+      // a new flow takes the oldest context
+      cid = m_nextContext;
+      m_nextContext = (m_nextContext + 1) % MAX_CONTEXTS;
+      if (m_contexts[cid].valid)
+        m_flows.erase(m_contexts[cid].flow);
+      m_contexts[cid].valid = false;
+      m_flows[flow] = cid;
+    }
+    else
+    {
+      cid = it->second;
+    }
+
+    Context &context = m_contexts[cid];
+    VpnHeaderBytes bytes;
+    if (!context.valid || context.sent >= REFRESH || !SameContext(context.headers, headers))
+    {
+      NS_LOG_LOGIC("IR for context " << uint32_t(cid));
+      context.valid = true;
+      context.flow = flow;
+      context.sent = 0;
+      std::copy(headers, headers + HEADERS_SIZE, context.headers);
+      context.crc = StaticCrc(headers);
+
+      bytes.m_bytes[0] = cid;
+      bytes.m_length = 1;
+      packet->AddHeader(bytes);
+      return VpnHeader::FLAG_HEADER_IR;
+    }
+
+    context.sent++;
+    bool checksum = (headers[26] | headers[27]) != 0;
+    bytes.m_bytes[0] = (explicitLength ? 0x80 : 0) | (checksum ? 0x40 : 0) | cid;
+    bytes.m_bytes[1] = context.crc;
+    bytes.m_bytes[2] = headers[4];
+    bytes.m_bytes[3] = headers[5];
+    bytes.m_length = 4;
+    if (checksum)
+    {
+      bytes.m_bytes[bytes.m_length++] = headers[26];
+      bytes.m_bytes[bytes.m_length++] = headers[27];
+    }
+    if (explicitLength)
+    {
+      WriteU16(bytes.m_bytes + bytes.m_length, size - HEADERS_SIZE);
+      bytes.m_length += 2;
+    }
+    packet->RemoveAtStart(HEADERS_SIZE);
+    packet->AddHeader(bytes);
+    return VpnHeader::FLAG_HEADER_COMPRESSED;
+  }
+
+  bool VpnHeaderCompressor::Decompress(Ptr<Packet> packet, uint8_t flags)
+  {
+    uint32_t size = packet->GetSize();
+    if (flags & VpnHeader::FLAG_HEADER_IR)
+    {
+      uint8_t cid;
+      if (size < 1 + HEADERS_SIZE)
+        return false;
+      packet->CopyData(&cid, 1);
+      packet->RemoveAtStart(1);
+      Context &context = m_contexts[cid % MAX_CONTEXTS];
+      context.valid = true;
+      packet->CopyData(context.headers, HEADERS_SIZE);
+      context.crc = StaticCrc(context.headers);
+      return true;
+    }
+    if (!(flags & VpnHeader::FLAG_HEADER_COMPRESSED))
+      return true;
+
+    uint8_t compressed[8];
+    if (size < 4)
+      return false;
+    packet->CopyData(compressed, std::min<uint32_t>(size, sizeof(compressed)));
+    bool explicitLength = compressed[0] & 0x80;
+    bool checksum = compressed[0] & 0x40;
+    uint32_t length = 4 + (checksum ? 2 : 0) + (explicitLength ? 2 : 0);
+    const Context &context = m_contexts[compressed[0] & 0x3f];
+    if (size < length || !context.valid)
+    {
+      NS_LOG_LOGIC("No context " << uint32_t(compressed[0] & 0x3f));
+      return false;
+    }
+    if (compressed[1] != context.crc)
+    {
+      NS_LOG_LOGIC("Context " << uint32_t(compressed[0] & 0x3f) << " belongs to another flow");
+      return false;
+    }
+    uint32_t payloadLength = explicitLength ? ReadU16(compressed + length - 2) : size - length;
+    packet->RemoveAtStart(length);
+
+    VpnHeaderBytes bytes;
+    bytes.m_length = HEADERS_SIZE;
+    uint8_t *headers = bytes.m_bytes;
+    std::copy(context.headers, context.headers + HEADERS_SIZE, headers);
+    WriteU16(headers + 2, HEADERS_SIZE + payloadLength);
+    headers[4] = compressed[2];
+    headers[5] = compressed[3];
+    WriteU16(headers + 24, HEADERS_SIZE - 20 + payloadLength);
+    headers[26] = checksum ? compressed[4] : 0;
+    headers[27] = checksum ? compressed[5] : 0;
+    if (headers[10] | headers[11])
+    {
+      uint32_t sum = 0;
+      headers[10] = headers[11] = 0;
+      for (int i = 0; i < 20; i += 2)
+        sum += ReadU16(headers + i);
+      while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+      WriteU16(headers + 10, ~sum & 0xffff);
+    }
+    packet->AddHeader(bytes);
+    return true;
+  }
+
+}
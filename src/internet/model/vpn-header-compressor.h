@@ -0,0 +1,58 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+#ifndef VPN_HEADER_COMPRESSOR_H
+#define VPN_HEADER_COMPRESSOR_H
+
+#include <stdint.h>
+#include <unordered_map>
+#include "ns3/packet.h"
+
+namespace ns3
+{
+
+  // ROHC style compression of the inner IPv4 / UDP headers (28 bytes) of a tunneled packet, unidirectional mode.
+  // every flow (addresses and ports) gets a context. its first packet, and again one after REFRESH compressed
+  // ones, goes out whole with the context id in front (VpnHeader::FLAG_HEADER_IR). the others only carry what
+  // changes :
+  //
+  //   L C cid(6)  crc(8)  ip identification(16)  [udp checksum(16) if C]  [payload length(16) if L]
+  //
+  // (VpnHeader::FLAG_HEADER_COMPRESSED). lengths come from the packet size, unless the cipher pads the payload
+  // and the sender asks for an explicit length. the ipv4 checksum is recomputed when the flow uses one.
+  // crc covers the static fields of the context, like the CRC of ROHC U-mode : when a context id moved to a
+  // new flow and its IR was lost, the receiver still holds the old flow and drops instead of misdelivering.
+  // the sender keeps one instance, the receiver one per session.
+  class VpnHeaderCompressor
+  {
+  public:
+    static const uint8_t MAX_CONTEXTS = 64;
+    static const uint32_t REFRESH = 32;
+
+    VpnHeaderCompressor();
+
+    // replaces the headers of packet by their compressed form, returns the VpnHeader flags to send with it,
+    // 0 if packet is not plain IPv4 / UDP and stays as it is
+    uint8_t Compress(Ptr<Packet> packet, bool explicitLength);
+    // rebuilds the headers of a packet sent with flags. false if the context is unknown (its IR packet was
+    // lost), the packet is useless then
+    bool Decompress(Ptr<Packet> packet, uint8_t flags);
+
+  private:
+    static const uint32_t HEADERS_SIZE = 28;
+
+    struct Context
+    {
+      bool valid;
+      uint64_t flow;                 // key in m_flows (sender)
+      uint32_t sent;                 // packets since the last IR (sender)
+      uint8_t headers[HEADERS_SIZE]; // headers of the last IR, static fields come from here
+      uint8_t crc;                   // StaticCrc of headers
+    };
+
+    Context m_contexts[MAX_CONTEXTS];
+    std::unordered_map<uint64_t, uint8_t> m_flows; // flow -> context id (sender)
+    uint8_t m_nextContext;                         // next context to (re)use (sender)
+  };
+
+}
+
+#endif /* VPN_HEADER_COMPRESSOR_H */
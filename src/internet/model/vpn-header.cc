@@ -1,11 +1,41 @@
 #include "ns3/vpn-header.h"
-#include "ns3/vpn-aes.h"
 #include "ns3/log.h"
+#include <algorithm>
 
 namespace ns3
 {
   NS_LOG_COMPONENT_DEFINE("VpnHeader");
   NS_OBJECT_ENSURE_REGISTERED(VpnHeader);
+
+  const uint8_t VpnHeader::VERSION;
+  const uint32_t VpnHeader::FIXED_SIZE;
+  const uint8_t VpnHeader::MAX_TAG_SIZE;
+  const uint8_t VpnHeader::FLAG_HEADER_IR;
+  const uint8_t VpnHeader::FLAG_HEADER_COMPRESSED;
+  const uint8_t VpnHeader::FLAG_PAYLOAD_COMPRESSED;
+  const uint8_t VpnHeader::FLAG_PROBE;
+  const uint8_t VpnHeader::FLAG_PROBE_ACK;
+  const uint8_t VpnHeader::FLAG_AGGREGATE;
+  const uint8_t VpnHeader::FLAG_REVERSE;
+
+  static uint64_t
+  ReadBigEndian(const uint8_t *bytes, int length)
+  {
+    uint64_t value = 0;
+    for (int i = 0; i < length; i++)
+      value = (value << 8) | bytes[i];
+    return value;
+  }
+
+  VpnHeader::VpnHeader()
+      : m_version(VERSION),
+        m_flags(0),
+        m_tagLength(0),
+        m_sessionId(0),
+        m_sequence(0)
+  {
+  }
+
   TypeId VpnHeader::GetTypeId(void)
   {
     static TypeId tid = TypeId("ns3::VpnHeader")
@@ -14,84 +44,135 @@ namespace ns3
     return tid;
   }
 
-  std::string VpnHeader::EncryptInput(const std::string &input, const std::string &cipherKey, bool verbose)
+  TypeId VpnHeader::GetInstanceTypeId(void) const
   {
-    m_sentOrigin = input;
-    AES aes128(128, MODE::ECB);
-    m_encrypted = aes128.encryption(input, cipherKey, verbose);
-    return m_encrypted;
+    return GetTypeId();
   }
 
-  std::string VpnHeader::DecryptInput(const std::string &cipherKey, bool verbose)
+  uint8_t VpnHeader::GetVersion(void) const
   {
-    AES aes128(128, MODE::ECB);
-    return aes128.decryption(VpnHeader::GetEncrypted(), cipherKey, verbose);
+    return m_version;
   }
 
-  TypeId VpnHeader::GetInstanceTypeId(void) const
+  void VpnHeader::SetFlags(uint8_t flags)
   {
-    return GetTypeId();
+    m_flags = flags;
   }
 
-  std::string VpnHeader::GetSentOrigin(void) const
+  uint8_t VpnHeader::GetFlags(void) const
   {
-    return m_sentOrigin;
+    return m_flags;
   }
 
-  std::string VpnHeader::GetEncrypted(void) const
+  void VpnHeader::SetSession(uint32_t sessionId, uint64_t sequence)
   {
-    return m_encrypted;
+    m_sessionId = sessionId;
+    m_sequence = sequence;
   }
 
-  void VpnHeader::Serialize(Buffer::Iterator start) const
+  uint32_t VpnHeader::GetSessionId(void) const
   {
-    const uint8_t *convert = reinterpret_cast<const uint8_t *>(m_sentOrigin.c_str());
-    NS_LOG_DEBUG("While Serialize Origin -> " << m_sentOrigin);
-    for (int i = 0; i < 32; i++)
-    {
-      start.WriteU8(convert[i]);
-    }
-
-    const uint8_t *convert2 = reinterpret_cast<const uint8_t *>(m_encrypted.c_str());
-    for (int i = 0; i < 32; i++)
-    {
-      start.WriteU8(convert2[i]);
-    }
-    NS_LOG_FUNCTION(this);
+    return m_sessionId;
+  }
+
+  uint64_t VpnHeader::GetSequence(void) const
+  {
+    return m_sequence;
+  }
+
+  static void
+  WriteBigEndian(uint8_t *bytes, uint64_t value, int length)
+  {
+    for (int i = 0; i < length; i++)
+      bytes[i] = uint8_t(value >> (8 * (length - 1 - i)));
+  }
+
+  void VpnHeader::GetNonce(uint8_t *iv) const
+  {
+    WriteBigEndian(iv, m_sessionId, 4);
+    WriteBigEndian(iv + 4, m_sequence, 8);
+    if (m_flags & FLAG_REVERSE)
+      iv[4] |= 0x80;
+    for (int i = 12; i < 16; i++)
+      iv[i] = 0;
+  }
+
+  void VpnHeader::GetAad(uint8_t *aad) const
+  {
+    aad[0] = m_version;
+    aad[1] = m_flags;
+    aad[2] = m_tagLength;
+    aad[3] = 0;
+    WriteBigEndian(aad + 4, m_sessionId, 4);
+    WriteBigEndian(aad + 8, m_sequence, 8);
+  }
+
+  bool VpnHeader::Peek(Ptr<const Packet> packet, uint32_t &sessionId, uint64_t &sequence, uint8_t &flags, uint8_t &tagLength)
+  {
+    uint8_t fixed[FIXED_SIZE];
+    if (packet->CopyData(fixed, FIXED_SIZE) < FIXED_SIZE || fixed[0] != VERSION)
+      return false;
+    // Deserialize reads as much of the tag as this
+    tagLength = std::min(fixed[2], MAX_TAG_SIZE);
+    if (packet->GetSize() < FIXED_SIZE + tagLength)
+      return false;
+    flags = fixed[1];
+    sessionId = ReadBigEndian(fixed + 4, 4);
+    sequence = ReadBigEndian(fixed + 8, 8);
+    return true;
+  }
+
+  void VpnHeader::SetTag(const uint8_t *tag, uint8_t length)
+  {
+    NS_ASSERT(length <= MAX_TAG_SIZE);
+    m_tagLength = length;
+    std::copy(tag, tag + length, m_tag);
+  }
+
+  const uint8_t *VpnHeader::GetTag(void) const
+  {
+    return m_tag;
+  }
+
+  uint8_t VpnHeader::GetTagLength(void) const
+  {
+    return m_tagLength;
   }
 
   uint32_t VpnHeader::GetSerializedSize(void) const
   {
-    return 64;
+    return FIXED_SIZE + m_tagLength;
+  }
+
+  void VpnHeader::Serialize(Buffer::Iterator start) const
+  {
+    uint8_t fixed[FIXED_SIZE];
+    GetAad(fixed);
+    start.Write(fixed, FIXED_SIZE);
+    start.Write(m_tag, m_tagLength);
+    NS_LOG_FUNCTION(this);
   }
 
   uint32_t VpnHeader::Deserialize(Buffer::Iterator start)
   {
+    // fixed part in one read, then the tag
     Buffer::Iterator i = start;
-
-    std::ostringstream ss;
-    for (int j = 0; j < 32; j++)
-    {
-      ss << i.ReadU8();
-    }
-    // ss << i.ReadNtohU64();
-    m_sentOrigin = ss.str();
-
-    std::ostringstream ss2;
-    for (int j = 0; j < 32; j++)
-    {
-      ss2 << i.ReadU8();
-    }
-    // ss2<< i.ReadNtohU64();
-    m_encrypted = ss2.str();
-
+    uint8_t fixed[FIXED_SIZE];
+    i.Read(fixed, FIXED_SIZE);
+    m_version = fixed[0];
+    m_flags = fixed[1];
+    m_tagLength = std::min(fixed[2], MAX_TAG_SIZE);
+    m_sessionId = ReadBigEndian(fixed + 4, 4);
+    m_sequence = ReadBigEndian(fixed + 8, 8);
+    i.Read(m_tag, m_tagLength);
     NS_LOG_FUNCTION(this);
 
-    return 64;
+    return GetSerializedSize();
   }
 
   void VpnHeader::Print(std::ostream &os) const
   {
-    os << "m_encrypted =" << m_encrypted << "\n";
+    os << "version=" << uint32_t(m_version) << " flags=" << uint32_t(m_flags) << " session=" << m_sessionId
+       << " sequence=" << m_sequence << " tag=" << uint32_t(m_tagLength);
   }
-}
\ No newline at end of file
+}
@@ -1,26 +1,82 @@
+#ifndef VPN_HEADER_H
+#define VPN_HEADER_H
+
 #include "ns3/header.h"
+#include "ns3/packet.h"
 #include "ns3/simulator.h"
+#include "ns3/vpn-cipher.h"
 
 namespace ns3
 {
 
+  // tunnel header in front of the encrypted inner packet (VpnPayload), 16 bytes plus the authentication tag of
+  // the suite :
+  //
+  //   0        1        2        3
+  //   version  flags    tag len  reserved
+  //   session id (32 bits)
+  //   sequence number (64 bits)
+  //   tag (tag len bytes, authenticated suites only)
+  //
+  // the per-packet nonce is session id || sequence number and is not sent separately. the owner of a session
+  // never repeats a sequence number, the other end answers under the same session with FLAG_REVERSE, which sets
+  // the top bit of the sequence in the nonce so the two directions never share one. sequence numbers stay below
+  // 2^63. the first 16 bytes are authenticated together with the payload (GetAad)
   class VpnHeader : public Header
   {
   public:
+    static const uint8_t VERSION = 1;
+    static const uint32_t FIXED_SIZE = 16;
+    static const uint8_t MAX_TAG_SIZE = 16;
+
+    // flags, see VpnHeaderCompressor, VpnPayloadCompressor and VPNApplication
+    static const uint8_t FLAG_HEADER_IR = 0x01;          // payload is context id || full inner headers
+    static const uint8_t FLAG_HEADER_COMPRESSED = 0x02;  // payload starts with compressed inner headers
+    static const uint8_t FLAG_PAYLOAD_COMPRESSED = 0x04; // payload is LZ compressed, see VpnPayloadCompressor
+    static const uint8_t FLAG_PROBE = 0x08;              // path MTU probe, payload starts with its size
+    static const uint8_t FLAG_PROBE_ACK = 0x10;          // answer to a probe, payload is its size
+    static const uint8_t FLAG_AGGREGATE = 0x20;          // payload is several framed inner packets
+    static const uint8_t FLAG_REVERSE = 0x40;            // sent to the owner of the session, not by it
+
+    VpnHeader();
     static TypeId GetTypeId(void);
     virtual TypeId GetInstanceTypeId(void) const;
     virtual void Print(std::ostream &os) const;
-    std::string EncryptInput(const std::string &input, const std::string &cipherKey, bool verbose);
-    std::string DecryptInput(const std::string &cipherKey, bool verbose);
     virtual uint32_t GetSerializedSize(void) const;
     virtual void Serialize(Buffer::Iterator start) const;
     virtual uint32_t Deserialize(Buffer::Iterator start);
-    std::string GetSentOrigin(void) const;
-    std::string GetEncrypted(void) const;
+
+    uint8_t GetVersion(void) const;
+    void SetFlags(uint8_t flags);
+    uint8_t GetFlags(void) const;
+
+    // peer of the tunnel (see VpnKeyTable) and per-session packet counter, together they give the payload nonce
+    void SetSession(uint32_t sessionId, uint64_t sequence);
+    uint32_t GetSessionId(void) const;
+    uint64_t GetSequence(void) const;
+    // 16 bytes : session id || direction bit + sequence || 0 (big endian). a suite with a 12 bytes nonce uses the
+    // first 12. flags have to be set before
+    void GetNonce(uint8_t *iv) const;
+    // FIXED_SIZE bytes : the header as serialized, without the tag
+    void GetAad(uint8_t *aad) const;
+
+    // reads session id, sequence, flags and tag length straight from the front of packet, without removing or
+    // deserializing the header. false if packet is too short for the header and its tag or not of this version
+    static bool Peek(Ptr<const Packet> packet, uint32_t &sessionId, uint64_t &sequence, uint8_t &flags, uint8_t &tagLength);
+
+    void SetTag(const uint8_t *tag, uint8_t length);
+    const uint8_t *GetTag(void) const;
+    uint8_t GetTagLength(void) const;
 
   private:
-    std::string m_sentOrigin;
-    std::string m_encrypted;
+    uint8_t m_version;
+    uint8_t m_flags;
+    uint8_t m_tagLength;
+    uint32_t m_sessionId;
+    uint64_t m_sequence;
+    uint8_t m_tag[MAX_TAG_SIZE];
   };
 
-}
\ No newline at end of file
+}
+
+#endif /* VPN_HEADER_H */
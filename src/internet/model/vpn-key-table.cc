@@ -0,0 +1,75 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+#include "ns3/vpn-key-table.h"
+#include "ns3/log.h"
+
+namespace ns3
+{
+  NS_LOG_COMPONENT_DEFINE("VpnKeyTable");
+
+  bool VpnKeyTable::Add(uint32_t sessionId, Ipv4Address tunnelAddress, const std::string &cipherName, const std::string &cipherKey)
+  {
+    NS_LOG_FUNCTION(this << sessionId << tunnelAddress << cipherName);
+    Ptr<VpnCipher> cipher = VpnCipher::Create(cipherName);
+    if (!cipher || !cipher->SetKey(cipherKey))
+    {
+      NS_LOG_WARN("Unusable key for session " << sessionId);
+      return false;
+    }
+
+    Remove(sessionId);
+    Peer peer = {sessionId, tunnelAddress, cipher};
+    m_bySession[sessionId] = m_peers.size();
+    m_byAddress[tunnelAddress.Get()] = m_peers.size();
+    m_peers.push_back(peer);
+    return true;
+  }
+
+  void VpnKeyTable::Remove(uint32_t sessionId)
+  {
+    std::unordered_map<uint32_t, uint32_t>::iterator it = m_bySession.find(sessionId);
+    if (it == m_bySession.end())
+      return;
+
+    uint32_t index = it->second;
+    m_bySession.erase(it);
+    std::unordered_map<uint32_t, uint32_t>::iterator address = m_byAddress.find(m_peers[index].tunnelAddress.Get());
+    if (address != m_byAddress.end() && address->second == index)
+      m_byAddress.erase(address);
+
+    // keep the vector dense : the last peer takes the free slot
+    if (index != m_peers.size() - 1)
+    {
+      m_peers[index] = m_peers.back();
+      m_bySession[m_peers[index].sessionId] = index;
+      address = m_byAddress.find(m_peers[index].tunnelAddress.Get());
+      if (address != m_byAddress.end() && address->second == m_peers.size() - 1)
+        address->second = index;
+    }
+    m_peers.pop_back();
+  }
+
+  void VpnKeyTable::Clear(void)
+  {
+    m_peers.clear();
+    m_bySession.clear();
+    m_byAddress.clear();
+  }
+
+  Ptr<VpnCipher> VpnKeyTable::Lookup(uint32_t sessionId) const
+  {
+    std::unordered_map<uint32_t, uint32_t>::const_iterator it = m_bySession.find(sessionId);
+    return it == m_bySession.end() ? Ptr<VpnCipher>() : m_peers[it->second].cipher;
+  }
+
+  Ptr<VpnCipher> VpnKeyTable::Lookup(Ipv4Address tunnelAddress) const
+  {
+    std::unordered_map<uint32_t, uint32_t>::const_iterator it = m_byAddress.find(tunnelAddress.Get());
+    return it == m_byAddress.end() ? Ptr<VpnCipher>() : m_peers[it->second].cipher;
+  }
+
+  uint32_t VpnKeyTable::GetN(void) const
+  {
+    return m_peers.size();
+  }
+
+}
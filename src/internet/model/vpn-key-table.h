@@ -0,0 +1,46 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+#ifndef VPN_KEY_TABLE_H
+#define VPN_KEY_TABLE_H
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ns3/ipv4-address.h"
+#include "ns3/vpn-cipher.h"
+
+namespace ns3
+{
+
+  // keys of the peers of a VPN gateway. every peer gets its own keyed cipher suite when it is added, so the
+  // key schedules are expanded once and not per packet. peers are found in O(1) by the session id carried in
+  // the VpnHeader or by the tunnel address of the client. the peers sit in one dense vector (removal moves the
+  // last one into the hole) and the two hash maps only hold indices into it.
+  class VpnKeyTable
+  {
+  public:
+    // adds the peer or replaces the one with the same session id, false if the suite or the key is not usable
+    bool Add(uint32_t sessionId, Ipv4Address tunnelAddress, const std::string &cipherName, const std::string &cipherKey);
+    void Remove(uint32_t sessionId);
+    void Clear(void);
+
+    Ptr<VpnCipher> Lookup(uint32_t sessionId) const; // 0 if the peer is unknown
+    Ptr<VpnCipher> Lookup(Ipv4Address tunnelAddress) const;
+    uint32_t GetN(void) const;
+
+  private:
+    struct Peer
+    {
+      uint32_t sessionId;
+      Ipv4Address tunnelAddress;
+      Ptr<VpnCipher> cipher;
+    };
+
+    std::vector<Peer> m_peers;
+    std::unordered_map<uint32_t, uint32_t> m_bySession; // session id -> index in m_peers
+    std::unordered_map<uint32_t, uint32_t> m_byAddress; // tunnel address -> index in m_peers
+  };
+
+}
+
+#endif /* VPN_KEY_TABLE_H */
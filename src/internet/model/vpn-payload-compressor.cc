@@ -0,0 +1,236 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+#include "ns3/vpn-payload-compressor.h"
+#include "ns3/log.h"
+#include <algorithm>
+#include <cstring>
+
+namespace ns3
+{
+  NS_LOG_COMPONENT_DEFINE("VpnPayloadCompressor");
+
+  const uint32_t VpnPayloadCompressor::MIN_SIZE;
+  const uint32_t VpnPayloadCompressor::BYPASS_MIN;
+  const uint32_t VpnPayloadCompressor::BYPASS_MAX;
+  const uint32_t VpnPayloadCompressor::HASH_BITS;
+  const uint32_t VpnPayloadCompressor::MAX_FLOWS;
+
+  static uint32_t
+  Read32(const uint8_t *bytes)
+  {
+    uint32_t value;
+    std::memcpy(&value, bytes, 4);
+    return value;
+  }
+
+  // literal or match length beyond the 4 bits of the token : 255 bytes until a smaller one
+  static bool
+  WriteLength(uint32_t length, uint8_t *&out, const uint8_t *end)
+  {
+    for (; length >= 255; length -= 255)
+    {
+      if (out == end)
+        return false;
+      *out++ = 255;
+    }
+    if (out == end)
+      return false;
+    *out++ = length;
+    return true;
+  }
+
+  static bool
+  ReadLength(uint32_t &length, const uint8_t *&in, const uint8_t *end)
+  {
+    uint8_t byte;
+    do
+    {
+      if (in == end)
+        return false;
+      byte = *in++;
+      length += byte;
+    } while (byte == 255);
+    return true;
+  }
+
+  VpnPayloadCompressor::VpnPayloadCompressor()
+  {
+    std::fill(m_hash, m_hash + (1 << HASH_BITS), 0);
+  }
+
+  uint64_t VpnPayloadCompressor::GetFlow(Ptr<const Packet> packet)
+  {
+    uint8_t headers[64];
+    uint32_t size = packet->CopyData(headers, sizeof(headers));
+    if (size < 20 || (headers[0] >> 4) != 4)
+      return 0;
+
+    uint64_t flow = (uint64_t(Read32(headers + 12)) << 32 | Read32(headers + 16)) ^ headers[9];
+    uint32_t ihl = (headers[0] & 0x0f) * 4;
+    if ((headers[9] == 6 || headers[9] == 17) && size >= ihl + 4)
+      flow ^= uint64_t(Read32(headers + ihl)) * 0x9E3779B97F4A7C15ULL;
+    return flow;
+  }
+
+  uint32_t VpnPayloadCompressor::CompressBytes(const uint8_t *input, uint32_t length, uint8_t *output, uint32_t capacity)
+  {
+    if (length > 0xfffe || capacity < 2)
+      return 0;
+    uint8_t *out = output;
+    const uint8_t *end = output + capacity;
+    *out++ = length >> 8;
+    *out++ = length & 0xff;
+
+    std::fill(m_hash, m_hash + (1 << HASH_BITS), 0);
+    uint32_t anchor = 0;
+    uint32_t pos = 0;
+    while (pos + 4 <= length)
+    {
+      uint32_t sequence = Read32(input + pos);
+      uint32_t hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+      uint32_t candidate = m_hash[hash];
+      m_hash[hash] = pos + 1;
+      if (!candidate || Read32(input + candidate - 1) != sequence)
+      {
+        pos++;
+        continue;
+      }
+
+      uint32_t match = candidate - 1;
+      uint32_t matchLength = 4;
+      while (pos + matchLength < length && input[match + matchLength] == input[pos + matchLength])
+        matchLength++;
+
+      // token, literals, offset, match length
+      uint32_t literals = pos - anchor;
+      if (out == end)
+        return 0;
+      uint8_t *token = out++;
+      *token = (std::min<uint32_t>(literals, 15) << 4) | std::min<uint32_t>(matchLength - 4, 15);
+      if (literals >= 15 && !WriteLength(literals - 15, out, end))
+        return 0;
+      if (uint32_t(end - out) < literals + 2)
+        return 0;
+      std::memcpy(out, input + anchor, literals);
+      out += literals;
+      *out++ = (pos - match) & 0xff;
+      *out++ = (pos - match) >> 8;
+      if (matchLength - 4 >= 15 && !WriteLength(matchLength - 4 - 15, out, end))
+        return 0;
+
+      pos += matchLength;
+      anchor = pos;
+    }
+
+    // the rest as literals, the decoder stops at the uncompressed length
+    uint32_t literals = length - anchor;
+    if (literals)
+    {
+      if (out == end)
+        return 0;
+      *out++ = std::min<uint32_t>(literals, 15) << 4;
+      if (literals >= 15 && !WriteLength(literals - 15, out, end))
+        return 0;
+      if (uint32_t(end - out) < literals)
+        return 0;
+      std::memcpy(out, input + anchor, literals);
+      out += literals;
+    }
+    return out - output;
+  }
+
+  uint32_t VpnPayloadCompressor::DecompressBytes(const uint8_t *input, uint32_t length, uint8_t *output, uint32_t capacity)
+  {
+    if (length < 2)
+      return 0;
+    const uint8_t *in = input + 2;
+    const uint8_t *end = input + length;
+    uint32_t size = (input[0] << 8) | input[1];
+    if (size > capacity)
+      return 0;
+
+    uint32_t out = 0;
+    while (out < size)
+    {
+      if (in == end)
+        return 0;
+      uint8_t token = *in++;
+      uint32_t literals = token >> 4;
+      if (literals == 15 && !ReadLength(literals, in, end))
+        return 0;
+      if (uint32_t(end - in) < literals || size - out < literals)
+        return 0;
+      std::memcpy(output + out, in, literals);
+      in += literals;
+      out += literals;
+      if (out == size)
+        break;
+
+      if (end - in < 2)
+        return 0;
+      uint32_t offset = in[0] | (in[1] << 8);
+      in += 2;
+      uint32_t matchLength = token & 0x0f;
+      if (matchLength == 15 && !ReadLength(matchLength, in, end))
+        return 0;
+      matchLength += 4;
+      if (offset == 0 || offset > out || size - out < matchLength)
+        return 0;
+      // may overlap itself, byte by byte
+      for (uint32_t i = 0; i < matchLength; i++, out++)
+        output[out] = output[out - offset];
+    }
+    return size;
+  }
+
+  bool VpnPayloadCompressor::Compress(Ptr<Packet> &packet, uint64_t flow)
+  {
+    uint32_t length = packet->GetSize();
+    if (length < MIN_SIZE)
+      return false;
+
+    if (m_flows.size() >= MAX_FLOWS && m_flows.find(flow) == m_flows.end())
+      m_flows.clear();
+    Flow &state = m_flows[flow];
+    if (state.bypass)
+    {
+      state.bypass--;
+      return false;
+    }
+
+    if (m_input.size() < length)
+      m_input.resize(length);
+    if (m_output.size() < length)
+      m_output.resize(length);
+    packet->CopyData(m_input.data(), length);
+
+    // worth it only below 7/8 of the original
+    uint32_t compressed = CompressBytes(m_input.data(), length, m_output.data(), length - length / 8);
+    if (!compressed)
+    {
+      state.failures++;
+      state.bypass = std::min(BYPASS_MIN << std::min<uint32_t>(state.failures - 1, 16), BYPASS_MAX);
+      NS_LOG_LOGIC("Flow " << flow << " incompressible, bypass for " << state.bypass << " packets");
+      return false;
+    }
+    state.failures = 0;
+    packet = Create<Packet>(m_output.data(), compressed);
+    return true;
+  }
+
+  bool VpnPayloadCompressor::Decompress(Ptr<Packet> &packet)
+  {
+    uint32_t length = packet->GetSize();
+    if (m_input.size() < length)
+      m_input.resize(length);
+    if (m_output.size() < 0xffff)
+      m_output.resize(0xffff);
+    packet->CopyData(m_input.data(), length);
+
+    uint32_t size = DecompressBytes(m_input.data(), length, m_output.data(), m_output.size());
+    if (!size)
+      return false;
+    packet = Create<Packet>(m_output.data(), size);
+    return true;
+  }
+
+}
@@ -0,0 +1,59 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+#ifndef VPN_PAYLOAD_COMPRESSOR_H
+#define VPN_PAYLOAD_COMPRESSOR_H
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+#include "ns3/packet.h"
+
+namespace ns3
+{
+
+  // LZ77 compression of the tunneled inner packet before it is encrypted (VpnHeader::FLAG_PAYLOAD_COMPRESSED).
+  // the format follows LZ4 blocks : a token with literal / match lengths (4 bits each, 255 bytes extensions),
+  // the literals, a 16 bits little endian offset, behind a 16 bits big endian uncompressed length so the
+  // decoder stops on its own before any block cipher padding.
+  // every flow is sampled : a packet that does not shrink by 1/8 turns compression off for the flow for
+  // BYPASS_MIN packets, doubling up to BYPASS_MAX while it keeps failing, so incompressible (e.g. already
+  // encrypted) traffic costs a trial now and then only.
+  class VpnPayloadCompressor
+  {
+  public:
+    static const uint32_t MIN_SIZE = 64;
+    static const uint32_t BYPASS_MIN = 16;
+    static const uint32_t BYPASS_MAX = 1024;
+
+    VpnPayloadCompressor();
+
+    // flow of an inner IPv4 packet (addresses, protocol, ports), to be taken before header compression
+    static uint64_t GetFlow(Ptr<const Packet> packet);
+
+    // replaces packet by its compressed form, false if it was left as it is
+    bool Compress(Ptr<Packet> &packet, uint64_t flow);
+    // reverse of Compress, false if the data is malformed
+    bool Decompress(Ptr<Packet> &packet);
+
+    // raw block interface, 0 if the output would not fit in capacity / the input is malformed
+    uint32_t CompressBytes(const uint8_t *input, uint32_t length, uint8_t *output, uint32_t capacity);
+    static uint32_t DecompressBytes(const uint8_t *input, uint32_t length, uint8_t *output, uint32_t capacity);
+
+  private:
+    static const uint32_t HASH_BITS = 12;
+    static const uint32_t MAX_FLOWS = 1024;
+
+    struct Flow
+    {
+      uint32_t bypass;   // packets left to send without trying
+      uint32_t failures; // trials in a row that did not pay off
+    };
+
+    uint16_t m_hash[1 << HASH_BITS]; // position + 1 of the last 4 bytes with that hash, 0 : none
+    std::unordered_map<uint64_t, Flow> m_flows;
+    std::vector<uint8_t> m_input;  // scratch, reused from packet to packet
+    std::vector<uint8_t> m_output; // scratch
+  };
+
+}
+
+#endif /* VPN_PAYLOAD_COMPRESSOR_H */
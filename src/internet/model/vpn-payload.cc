@@ -0,0 +1,153 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+#include "ns3/vpn-payload.h"
+#include "ns3/log.h"
+#include <algorithm>
+
+namespace ns3
+{
+  NS_LOG_COMPONENT_DEFINE("VpnPayload");
+  NS_OBJECT_ENSURE_REGISTERED(VpnPayload);
+
+  // one scratch buffer per packet of a batch, kept for the next batch (the simulator is single threaded)
+  static std::vector<std::vector<uint8_t>> g_scratch;
+  static std::vector<VpnCipher::Message> g_messages;
+  static std::vector<uint8_t> g_nonces;
+  static std::vector<uint8_t> g_aad;
+
+  static void
+  PrepareScratch(uint32_t count)
+  {
+    if (g_scratch.size() < count)
+      g_scratch.resize(count);
+    g_messages.resize(count);
+    g_nonces.resize(count * 16);
+    g_aad.resize(count * VpnHeader::FIXED_SIZE);
+  }
+
+  VpnPayload::VpnPayload()
+      : m_data(0),
+        m_length(0)
+  {
+  }
+
+  TypeId VpnPayload::GetTypeId(void)
+  {
+    static TypeId tid = TypeId("ns3::VpnPayload")
+                            .SetParent<Header>()
+                            .AddConstructor<VpnPayload>();
+    return tid;
+  }
+
+  TypeId VpnPayload::GetInstanceTypeId(void) const
+  {
+    return GetTypeId();
+  }
+
+  void VpnPayload::Print(std::ostream &os) const
+  {
+    os << "length=" << m_length;
+  }
+
+  uint32_t VpnPayload::GetSerializedSize(void) const
+  {
+    return m_length;
+  }
+
+  void VpnPayload::Serialize(Buffer::Iterator start) const
+  {
+    NS_ASSERT(m_data);
+    start.Write(m_data->data(), m_length);
+  }
+
+  uint32_t VpnPayload::Deserialize(Buffer::Iterator start)
+  {
+    m_length = start.GetRemainingSize();
+    if (!m_data)
+    {
+      start.Next(m_length);
+      return m_length;
+    }
+    if (m_data->size() < m_length)
+      m_data->resize(m_length);
+    start.Read(m_data->data(), m_length);
+    return m_length;
+  }
+
+  void VpnPayload::EncryptBatch(Ptr<Packet> *packets, VpnHeader *headers, uint32_t count, Ptr<VpnCipher> cipher)
+  {
+    PrepareScratch(count);
+    uint32_t tagSize = cipher->GetTagSize();
+    for (uint32_t i = 0; i < count; i++)
+    {
+      uint32_t length = packets[i]->GetSize();
+      std::vector<uint8_t> &scratch = g_scratch[i];
+      if (scratch.size() < length + cipher->GetOverhead(length))
+        scratch.resize(length + cipher->GetOverhead(length));
+      packets[i]->CopyData(scratch.data(), length);
+      packets[i]->RemoveAtStart(length);
+
+      // the tag length is part of the authenticated header, so it is set before encrypting
+      uint8_t tag[VpnHeader::MAX_TAG_SIZE] = {0};
+      headers[i].SetTag(tag, tagSize);
+      headers[i].GetNonce(g_nonces.data() + i * 16);
+      headers[i].GetAad(g_aad.data() + i * VpnHeader::FIXED_SIZE);
+
+      VpnCipher::Message message = {g_nonces.data() + i * 16, g_aad.data() + i * VpnHeader::FIXED_SIZE, VpnHeader::FIXED_SIZE,
+                                    scratch.data(), length, scratch.data(), 0, false};
+      g_messages[i] = message;
+    }
+
+    cipher->EncryptBatch(g_messages.data(), count);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+      // ciphertext || tag : the tag moves into the header
+      uint32_t length = g_messages[i].outLength - tagSize;
+      headers[i].SetTag(g_scratch[i].data() + length, tagSize);
+
+      VpnPayload payload;
+      payload.m_data = &g_scratch[i];
+      payload.m_length = length;
+      packets[i]->AddHeader(payload);
+    }
+  }
+
+  void VpnPayload::DecryptBatch(Ptr<Packet> *packets, const VpnHeader *headers, uint32_t count, Ptr<VpnCipher> cipher, bool *ok)
+  {
+    PrepareScratch(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+      VpnPayload payload;
+      payload.m_data = &g_scratch[i];
+      packets[i]->RemoveHeader(payload);
+
+      // the suite expects ciphertext || tag
+      std::vector<uint8_t> &scratch = g_scratch[i];
+      uint32_t tagLength = headers[i].GetTagLength();
+      if (scratch.size() < payload.m_length + tagLength)
+        scratch.resize(payload.m_length + tagLength);
+      std::copy(headers[i].GetTag(), headers[i].GetTag() + tagLength, scratch.data() + payload.m_length);
+
+      headers[i].GetNonce(g_nonces.data() + i * 16);
+      headers[i].GetAad(g_aad.data() + i * VpnHeader::FIXED_SIZE);
+      VpnCipher::Message message = {g_nonces.data() + i * 16, g_aad.data() + i * VpnHeader::FIXED_SIZE, VpnHeader::FIXED_SIZE,
+                                    scratch.data(), payload.m_length + tagLength, scratch.data(), 0, false};
+      g_messages[i] = message;
+    }
+
+    cipher->DecryptBatch(g_messages.data(), count);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+      // a tag length that does not fit the suite fails like a wrong tag
+      ok[i] = g_messages[i].ok && headers[i].GetTagLength() == cipher->GetTagSize();
+      VpnPayload payload;
+      payload.m_data = &g_scratch[i];
+      payload.m_length = ok[i] ? g_messages[i].outLength : g_messages[i].length - headers[i].GetTagLength(); // failed : the ciphertext goes back
+      if (!ok[i])
+        NS_LOG_DEBUG("Payload authentication failed");
+      packets[i]->AddHeader(payload);
+    }
+  }
+
+}
@@ -0,0 +1,47 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+#ifndef VPN_PAYLOAD_H
+#define VPN_PAYLOAD_H
+
+#include <stdint.h>
+#include <vector>
+#include "ns3/header.h"
+#include "ns3/packet.h"
+#include "ns3/vpn-cipher.h"
+#include "ns3/vpn-header.h"
+
+namespace ns3
+{
+
+  // the tunneled inner packet, encrypted in a copy : ns-3 gives no mutable view of a Packet buffer, so the
+  // bytes are copied out into a scratch buffer with one bulk read, encrypted in place there and copied back
+  // as a VpnPayload header with one bulk Buffer::Iterator write. two copies per direction, the least the
+  // Packet API allows. the scratch is reused from packet to packet and the cipher suites keep their batch
+  // state between calls as well, so once the scratch has grown the only allocations left are those of the
+  // Packet buffers. the receiver removes the header and writes the plaintext back the same way.
+  class VpnPayload : public Header
+  {
+  public:
+    VpnPayload();
+
+    static TypeId GetTypeId(void);
+    virtual TypeId GetInstanceTypeId(void) const;
+    virtual void Print(std::ostream &os) const;
+    virtual uint32_t GetSerializedSize(void) const;
+    virtual void Serialize(Buffer::Iterator start) const;
+    virtual uint32_t Deserialize(Buffer::Iterator start); // takes everything up to the end of the packet
+
+    // encrypts the whole content of packets[i] under the nonce of headers[i], which authenticates the header too
+    // (VpnHeader::GetAad) and receives the tag. the packet grows by the padding of block modes
+    static void EncryptBatch(Ptr<Packet> *packets, VpnHeader *headers, uint32_t count, Ptr<VpnCipher> cipher);
+    // reverse of EncryptBatch. ok[i] is false if the tag of packets[i] does not match, that packet is left as it
+    // was. block modes keep their padding (the caller knows the inner length)
+    static void DecryptBatch(Ptr<Packet> *packets, const VpnHeader *headers, uint32_t count, Ptr<VpnCipher> cipher, bool *ok);
+
+  private:
+    std::vector<uint8_t> *m_data; // scratch holding the payload, 0 : Deserialize only skips the bytes
+    uint32_t m_length;
+  };
+
+}
+
+#endif /* VPN_PAYLOAD_H */
@@ -0,0 +1,69 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+#include "ns3/vpn-replay-window.h"
+#include <algorithm>
+
+namespace ns3
+{
+  const uint32_t VpnReplayWindow::DEFAULT_SIZE;
+
+  // smallest power of two holding the window plus the word being cleared
+  static uint32_t
+  RingWords(uint32_t size)
+  {
+    uint32_t words = 1;
+    while (words < size / 64 + 1)
+      words <<= 1;
+    return words;
+  }
+
+  VpnReplayWindow::VpnReplayWindow(uint32_t size)
+      : m_size((std::max<uint32_t>(size, 1) + 63) & ~63u),
+        m_top(0),
+        m_bitmap(RingWords(m_size), 0),
+        m_mask(m_bitmap.size() - 1)
+  {
+  }
+
+  bool VpnReplayWindow::Check(uint64_t sequence) const
+  {
+    // the sender starts at 1
+    if (sequence == 0)
+      return false;
+    if (sequence > m_top)
+      return true;
+    if (m_top - sequence >= m_size)
+      return false;
+    uint64_t word = m_bitmap[(sequence >> 6) & m_mask];
+    return !(word & (uint64_t(1) << (sequence & 63)));
+  }
+
+  bool VpnReplayWindow::Update(uint64_t sequence)
+  {
+    if (!Check(sequence))
+      return false;
+
+    if (sequence > m_top)
+    {
+      // clear the words the window slides over, at most the whole ring
+      uint64_t words = (sequence >> 6) - (m_top >> 6);
+      words = std::min<uint64_t>(words, m_bitmap.size());
+      for (uint64_t i = 1; i <= words; i++)
+        m_bitmap[((m_top >> 6) + i) & m_mask] = 0;
+      m_top = sequence;
+    }
+    m_bitmap[(sequence >> 6) & m_mask] |= uint64_t(1) << (sequence & 63);
+    return true;
+  }
+
+  void VpnReplayWindow::Reset(void)
+  {
+    m_top = 0;
+    std::fill(m_bitmap.begin(), m_bitmap.end(), 0);
+  }
+
+  uint32_t VpnReplayWindow::GetSize(void) const
+  {
+    return m_size;
+  }
+
+}
@@ -0,0 +1,43 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+#ifndef VPN_REPLAY_WINDOW_H
+#define VPN_REPLAY_WINDOW_H
+
+#include <stdint.h>
+#include <vector>
+
+namespace ns3
+{
+
+  // anti-replay window over the sequence numbers of one session (VpnHeader::GetSequence). a sequence number is
+  // accepted once, and only if it is newer than the highest one seen or within the last GetSize() of it.
+  // the seen numbers live in a ring of 64 bits words, at least one word more than the window so sliding forward
+  // only clears whole words. the ring is a power of two words : Check and Update are a shift and a mask,
+  // independent of the window size.
+  class VpnReplayWindow
+  {
+  public:
+    static const uint32_t DEFAULT_SIZE = 1024;
+
+    // size is rounded up to a multiple of 64
+    explicit VpnReplayWindow(uint32_t size = DEFAULT_SIZE);
+
+    // false for a duplicate or a sequence number older than the window, nothing is recorded. used before the
+    // payload is decrypted
+    bool Check(uint64_t sequence) const;
+    // records sequence, to be called once the payload authenticated. false if it was not acceptable (e.g. a
+    // duplicate within the same batch)
+    bool Update(uint64_t sequence);
+    void Reset(void);
+
+    uint32_t GetSize(void) const;
+
+  private:
+    uint32_t m_size;                // window width in sequence numbers
+    uint64_t m_top;                 // highest sequence number recorded, 0 : none yet
+    std::vector<uint64_t> m_bitmap; // bit sequence % 64 of word (sequence / 64) & m_mask
+    uint64_t m_mask;                // words in m_bitmap - 1
+  };
+
+}
+
+#endif /* VPN_REPLAY_WINDOW_H */
@@ -0,0 +1,94 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+#include "ns3/vpn-thread-pool.h"
+#include <algorithm>
+
+namespace ns3
+{
+
+  VpnThreadPool::VpnThreadPool(uint32_t threads)
+      : m_task(0),
+        m_count(0),
+        m_next(0),
+        m_pending(0),
+        m_stop(false)
+  {
+    if (threads == 0)
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    for (uint32_t i = 1; i < threads; ++i)
+      m_workers.push_back(std::thread(&VpnThreadPool::Work, this));
+  }
+
+  VpnThreadPool::~VpnThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_wake.notify_all();
+    for (std::thread &worker : m_workers)
+      worker.join();
+  }
+
+  uint32_t VpnThreadPool::GetThreads(void) const
+  {
+    return m_workers.size() + 1;
+  }
+
+  void VpnThreadPool::Run(size_t count, const std::function<void(size_t)> &task)
+  {
+    if (count == 0)
+      return;
+    if (count == 1 || m_workers.empty())
+    {
+      for (size_t i = 0; i < count; ++i)
+        task(i);
+      return;
+    }
+
+    std::lock_guard<std::mutex> run(m_runMutex);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_task = &task;
+    m_count = count;
+    m_next = 0;
+    m_pending = count;
+    m_wake.notify_all();
+
+    // the caller takes tasks too instead of only waiting
+    while (m_next < m_count)
+    {
+      size_t i = m_next++;
+      lock.unlock();
+      task(i);
+      lock.lock();
+      --m_pending;
+    }
+    m_done.wait(lock, [this]() { return m_pending == 0; });
+    m_task = 0;
+  }
+
+  void VpnThreadPool::Work(void)
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+      m_wake.wait(lock, [this]() { return m_stop || m_next < m_count; });
+      if (m_stop)
+        return;
+
+      size_t i = m_next++;
+      const std::function<void(size_t)> &task = *m_task;
+      lock.unlock();
+      task(i);
+      lock.lock();
+      if (--m_pending == 0)
+        m_done.notify_all();
+    }
+  }
+
+  VpnThreadPool &VpnThreadPool::GetDefault(void)
+  {
+    static VpnThreadPool pool;
+    return pool;
+  }
+
+}
@@ -0,0 +1,51 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+#ifndef VPN_THREAD_POOL_H
+#define VPN_THREAD_POOL_H
+
+#include <stdint.h>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ns3
+{
+
+  // fixed set of worker threads for splitting bulk crypto work (AES::bulkEncryption / bulkDecryption).
+  // the simulator itself stays single threaded, a Run call returns only after every task finished.
+  class VpnThreadPool
+  {
+  public:
+    explicit VpnThreadPool(uint32_t threads = 0); // threads including the caller, 0 : one per hardware thread
+    ~VpnThreadPool();
+
+    uint32_t GetThreads(void) const;
+
+    // runs task(0) .. task(count - 1) on the workers and the calling thread and waits for all of them.
+    // tasks must not call Run on the same pool
+    void Run(size_t count, const std::function<void(size_t)> &task);
+
+    static VpnThreadPool &GetDefault(void);
+
+  private:
+    VpnThreadPool(const VpnThreadPool &) = delete;
+    VpnThreadPool &operator=(const VpnThreadPool &) = delete;
+
+    void Work(void);
+
+    std::vector<std::thread> m_workers;
+    std::mutex m_runMutex; // one Run at a time
+    std::mutex m_mutex;    // guards everything below
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    const std::function<void(size_t)> *m_task;
+    size_t m_count;   // tasks of the current Run
+    size_t m_next;    // next task to hand out
+    size_t m_pending; // tasks not finished yet
+    bool m_stop;
+  };
+
+}
+
+#endif /* VPN_THREAD_POOL_H */
@@ -0,0 +1,98 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+#include "ns3/vpn-tunnel-mtu.h"
+#include "ns3/vpn-header.h"
+#include "ns3/log.h"
+#include <algorithm>
+
+namespace ns3
+{
+  NS_LOG_COMPONENT_DEFINE("VpnTunnelMtu");
+
+  const uint32_t VpnTunnelMtu::OUTER_HEADERS_SIZE;
+  const uint32_t VpnTunnelMtu::MIN_UNDERLAY_MTU;
+
+  uint32_t VpnTunnelMtu::GetOuterSize(uint32_t innerLength, Ptr<const VpnCipher> cipher)
+  {
+    // + 1 : context id in front of an IR packet of header compression
+    uint32_t payload = innerLength + 1;
+    return OUTER_HEADERS_SIZE + VpnHeader::FIXED_SIZE + payload + cipher->GetOverhead(payload);
+  }
+
+  uint32_t VpnTunnelMtu::GetTunnelMtu(uint32_t underlayMtu, Ptr<const VpnCipher> cipher)
+  {
+    uint32_t fixed = OUTER_HEADERS_SIZE + VpnHeader::FIXED_SIZE + cipher->GetTagSize() + 1;
+    if (underlayMtu <= fixed)
+      return 0;
+    // the padding of block modes only depends on the length modulo the block, a few steps at most
+    uint32_t mtu = underlayMtu - fixed;
+    while (mtu && GetOuterSize(mtu, cipher) > underlayMtu)
+      mtu--;
+    return mtu;
+  }
+
+  bool VpnTunnelMtu::ClampMss(Ptr<Packet> &packet, uint16_t mss)
+  {
+    // ipv4 header (up to 60 bytes) and tcp header with options (up to 60 bytes)
+    uint8_t headers[120];
+    uint32_t size = packet->CopyData(headers, sizeof(headers));
+    if (size < 20 || (headers[0] >> 4) != 4 || headers[9] != 6 || (((headers[6] << 8) | headers[7]) & 0x1fff) != 0)
+      return false;
+    uint32_t ihl = (headers[0] & 0x0f) * 4;
+    if (ihl < 20 || size < ihl + 20)
+      return false;
+    uint8_t *tcp = headers + ihl;
+    uint32_t dataOffset = (tcp[12] >> 4) * 4;
+    if (!(tcp[13] & 0x02) || dataOffset < 20 || size < ihl + dataOffset)
+      return false;
+
+    for (uint32_t i = 20; i < dataOffset;)
+    {
+      uint8_t kind = tcp[i];
+      if (kind == 0) // end of options
+        break;
+      if (kind == 1) // nop
+      {
+        i++;
+        continue;
+      }
+      if (i + 1 >= dataOffset || tcp[i + 1] < 2 || i + tcp[i + 1] > dataOffset)
+        break;
+      if (kind == 2 && tcp[i + 1] == 4)
+      {
+        uint16_t old = (tcp[i + 2] << 8) | tcp[i + 3];
+        if (old <= mss)
+          return false;
+        NS_LOG_LOGIC("Clamping MSS " << old << " -> " << mss);
+        // the option may sit on odd offsets, the checksum covers the 16 bits words around it
+        uint32_t first = (i + 2) & ~1u;
+        uint32_t last = (i + 5) & ~1u;
+        uint8_t before[4];
+        std::copy(tcp + first, tcp + last, before);
+        tcp[i + 2] = mss >> 8;
+        tcp[i + 3] = mss & 0xff;
+
+        // incremental update of the checksum (RFC 1624), 0 : checksums are off
+        uint16_t checksum = (tcp[16] << 8) | tcp[17];
+        if (checksum)
+        {
+          uint32_t sum = uint16_t(~checksum);
+          for (uint32_t j = first; j < last; j += 2)
+            sum += uint16_t(~((before[j - first] << 8) | before[j - first + 1])) + ((tcp[j] << 8) | tcp[j + 1]);
+          while (sum >> 16)
+            sum = (sum & 0xffff) + (sum >> 16);
+          checksum = ~sum;
+          tcp[16] = checksum >> 8;
+          tcp[17] = checksum & 0xff;
+        }
+
+        Ptr<Packet> clamped = Create<Packet>(headers, ihl + dataOffset);
+        clamped->AddAtEnd(packet->CreateFragment(ihl + dataOffset, packet->GetSize() - ihl - dataOffset));
+        packet = clamped;
+        return true;
+      }
+      i += tcp[i + 1];
+    }
+    return false;
+  }
+
+}
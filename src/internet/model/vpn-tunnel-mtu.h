@@ -0,0 +1,33 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+#ifndef VPN_TUNNEL_MTU_H
+#define VPN_TUNNEL_MTU_H
+
+#include <stdint.h>
+#include "ns3/packet.h"
+#include "ns3/vpn-cipher.h"
+
+namespace ns3
+{
+
+  // sizes of the tunnel, so that a full size inner packet still leaves the underlay in one piece :
+  // outer IPv4 / UDP, VpnHeader with tag, the context id byte of header compression and the block padding
+  // of the suite all come on top of the inner packet.
+  class VpnTunnelMtu
+  {
+  public:
+    static const uint32_t OUTER_HEADERS_SIZE = 28; // outer IPv4 + UDP
+    static const uint32_t MIN_UNDERLAY_MTU = 576;  // every IPv4 link carries this
+
+    // largest inner packet whose tunneled packet fits underlayMtu
+    static uint32_t GetTunnelMtu(uint32_t underlayMtu, Ptr<const VpnCipher> cipher);
+    // size of the outer IPv4 packet carrying an inner packet of innerLength bytes (uncompressed)
+    static uint32_t GetOuterSize(uint32_t innerLength, Ptr<const VpnCipher> cipher);
+
+    // lowers the MSS option of an IPv4 TCP SYN to mss and fixes the TCP checksum. true if packet was
+    // changed, it is then replaced by a new packet
+    static bool ClampMss(Ptr<Packet> &packet, uint16_t mss);
+  };
+
+}
+
+#endif /* VPN_TUNNEL_MTU_H */